@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "image.h"
+
+#ifndef __ASSEMBLER_HEADER__
+#define __ASSEMBLER_HEADER__
+
+/*
+ * Two pass assembler over the Instructions encoders.
+ *
+ * Pass one is just emitting: words are appended as they are encoded,
+ * label() binds a name to the next address and branch() appends a
+ * CALL/GOTO/BRA whose operand is filled in later. Names are interned in a
+ * hash table, so each reference records only a symbol index. Pass two,
+ * link(), walks the relocation list once and patches every operand, so
+ * labels may be referenced before or after they are defined.
+ */
+class Assembler{
+public:
+	typedef struct symbol{
+		std::string name;
+		uint32_t addr;
+		bool defined;
+	}Symbol;
+
+	/* Append a word; returns its address */
+	uint32_t emit( uint32_t word ){
+		code.push_back( word );
+		return code.size() - 1;
+	}
+	/* Bind name to the address of the next word */
+	bool label( const char* name ){
+		Symbol& s = m_sym[ intern( name ) ];
+		if( s.defined ){
+			fprintf(stderr, "Label %s defined twice\n", name);
+			return false;
+		}
+		s.addr = code.size();
+		s.defined = true;
+		return true;
+	}
+	/* Append a CALL, GOTO or BRA to target */
+	uint32_t branch( uint32_t word, const char* target ){
+		Reloc r = { (uint32_t)code.size(), intern( target ) };
+		m_reloc.push_back( r );
+		return emit( word );
+	}
+
+	/* Patch every reference and copy the program into img */
+	bool link( Image& img ){
+		bool ok = true;
+		for( size_t i = 0; i < m_reloc.size(); i++ ){
+			const Reloc& r = m_reloc[i];
+			const Symbol& s = m_sym[ r.sym ];
+			if( !s.defined ){
+				fprintf(stderr, "%04x: undefined label %s\n", r.addr, s.name.c_str());
+				ok = false;
+				continue;
+			}
+			if( !patch( code[ r.addr ], r.addr, s ) ) ok = false;
+		}
+		img.clear();
+		for( size_t i = 0; i < code.size(); i++ ){
+			img.set( i, code[i] );
+		}
+		return ok;
+	}
+
+	/* Address of a defined label, or false */
+	bool lookup( const char* name, uint32_t& addr ) const{
+		std::unordered_map<std::string, uint32_t>::const_iterator it = m_index.find( name );
+		if( it == m_index.end() || !m_sym[ it->second ].defined ) return false;
+		addr = m_sym[ it->second ].addr;
+		return true;
+	}
+	const std::vector<Symbol>& symbols() const{
+		return m_sym;
+	}
+	uint32_t size() const{
+		return code.size();
+	}
+	void clear(){
+		code.clear();
+		m_sym.clear();
+		m_index.clear();
+		m_reloc.clear();
+	}
+
+	std::vector<uint32_t> code;
+
+private:
+	typedef struct reloc{
+		uint32_t addr;
+		uint32_t sym;
+	}Reloc;
+
+	uint32_t intern( const char* name ){
+		std::pair<std::unordered_map<std::string, uint32_t>::iterator, bool> r =
+			m_index.insert( std::make_pair( std::string( name ), (uint32_t)m_sym.size() ) );
+		if( r.second ){
+			Symbol s = { name, 0, false };
+			m_sym.push_back( s );
+		}
+		return r.first->second;
+	}
+
+	static bool patch( uint32_t& word, uint32_t addr, const Symbol& s ){
+		if( (word & 0x3000) == 0x2000 ){ //CALL, GOTO
+			if( (s.addr ^ addr) & 0x3800 ){
+				fprintf(stderr, "%04x: %s at %04x is in another page\n", addr, s.name.c_str(), s.addr);
+				return false;
+			}
+			word = ( word & 0x3800 ) | ( s.addr & 0x7ff );
+			return true;
+		}
+		if( (word & 0x3e00) == 0x3200 ){ //BRA
+			int32_t k = (int32_t)s.addr - (int32_t)( addr + 1 );
+			if( k < -256 || k > 255 ){
+				fprintf(stderr, "%04x: %s at %04x out of BRA range\n", addr, s.name.c_str(), s.addr);
+				return false;
+			}
+			word = 0x3200 | ( k & 0x1ff );
+			return true;
+		}
+		fprintf(stderr, "%04x: %04x cannot reference a label\n", addr, word);
+		return false;
+	}
+
+	std::vector<Symbol> m_sym;
+	std::unordered_map<std::string, uint32_t> m_index;
+	std::vector<Reloc> m_reloc;
+};
+
+#endif
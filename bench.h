@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include "timing.h"
+#include "transport.h"
+#include "instructions.h"
+
+#ifndef __BENCH_HEADER__
+#define __BENCH_HEADER__
+
+#define BENCH_RUNS 100	//samples per cheap operation
+#define BENCH_SLOW 10	//samples per erase/row/upload
+
+/* Pass-through transport that counts what crosses the wire */
+class Meter final : public Transport{
+public:
+	Meter( Transport& inner ){
+		m_inner = &inner;
+		reset();
+	}
+	void edge( uint32_t set, uint32_t clr ){
+		m_inner->edge( set, clr );
+	}
+	void hold( nsec_t ns ){
+		m_held += ns;
+		m_inner->hold( ns );
+	}
+	void write( uint32_t word, unsigned int numberofbits ){
+		m_bits += numberofbits;
+		if( numberofbits == PAYLOADSZ ) m_words++;
+		m_inner->write( word, numberofbits );
+	}
+	uint32_t read( unsigned int numberofbits ){
+		m_bits += numberofbits;
+		m_words++;
+		return m_inner->read( numberofbits );
+	}
+	void outputs(){
+		m_inner->outputs();
+	}
+
+	void reset(){
+		m_bits = 0;
+		m_words = 0;
+		m_held = 0;
+	}
+	/* Time the traffic should take at spec clock widths and holds */
+	nsec_t nominal() const{
+		return m_held + m_bits * ( TCKH + TCKL );
+	}
+	uint64_t bits() const{ return m_bits; }
+	uint64_t words() const{ return m_words; }
+private:
+	Transport* m_inner;
+	uint64_t m_bits;
+	uint64_t m_words;
+	nsec_t m_held;
+};
+
+/*
+ * Latency samples per named operation, plus the wire traffic they caused,
+ * written out as JSON so two runs can be diffed. Latencies and rates are
+ * host CLOCK_MONOTONIC time: against GPIO they include every hold,
+ * against the emulated target they are our own overhead. wire_ns is
+ * what the same traffic costs at spec widths, for comparison.
+ */
+class Bench{
+public:
+	typedef struct series{
+		std::string name;
+		std::vector<nsec_t> ns;
+		uint64_t bits;
+		uint64_t words;
+		nsec_t wire;
+	}Series;
+
+	Bench( Meter& meter ){
+		m_meter = &meter;
+	}
+
+	/* Time one call of f under name */
+	template<typename F>
+	void sample( const char* name, F f ){
+		Series& s = find( name );
+		m_meter->reset();
+		nsec_t t = Timing::now();
+		f();
+		t = Timing::now() - t;
+		s.ns.push_back( t );
+		s.bits += m_meter->bits();
+		s.words += m_meter->words();
+		s.wire += m_meter->nominal();
+	}
+
+	bool write( const char* path, const char* transport ){
+		FILE* fp = fopen( path, "w" );
+		if( fp == NULL ){
+			fprintf(stderr, "Cannot write %s\n", path);
+			return false;
+		}
+		write( fp, transport );
+		fclose( fp );
+		return true;
+	}
+	void write( FILE* fp, const char* transport ){
+		fprintf(fp, "{\n  \"transport\": \"%s\",\n", transport);
+		fprintf(fp, "  \"timer_overhead_ns\": %" PRIu64 ",\n", Timing::overhead());
+		fprintf(fp, "  \"ops\": {");
+		for( size_t i = 0; i < m_series.size(); i++ ){
+			print( fp, m_series[i] );
+			fprintf(fp, "%s", i + 1 < m_series.size() ? "," : "");
+		}
+		fprintf(fp, "\n  }\n}\n");
+	}
+
+private:
+	Series& find( const char* name ){
+		for( size_t i = 0; i < m_series.size(); i++ ){
+			if( m_series[i].name == name ) return m_series[i];
+		}
+		Series s = { name, std::vector<nsec_t>(), 0, 0, 0 };
+		m_series.push_back( s );
+		return m_series.back();
+	}
+	static void print( FILE* fp, const Series& s ){
+		std::vector<nsec_t> v( s.ns );
+		std::sort( v.begin(), v.end() );
+		nsec_t total = 0;
+		for( size_t i = 0; i < v.size(); i++ ) total += v[i];
+		size_t n = v.size();
+		double secs = total / 1e9;
+		fprintf(fp, "\n    \"%s\": { \"n\": %zu, \"min_ns\": %" PRIu64 ", \"p50_ns\": %" PRIu64
+				", \"p90_ns\": %" PRIu64 ", \"p99_ns\": %" PRIu64 ", \"max_ns\": %" PRIu64
+				", \"mean_ns\": %" PRIu64 ", \"wire_ns\": %" PRIu64 ", \"bits_per_s\": %.0f, \"words_per_s\": %.0f }",
+				s.name.c_str(), n, v[0], v[(n - 1) * 50 / 100], v[(n - 1) * 90 / 100],
+				v[(n - 1) * 99 / 100], v[n - 1], total / n, s.wire / n,
+				secs > 0 ? s.bits / secs : 0.0, secs > 0 ? s.words / secs : 0.0 );
+	}
+
+	Meter* m_meter;
+	std::vector<Series> m_series;
+};
+
+#endif
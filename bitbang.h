@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "pic.h"
+#include "timing.h"
+#include "session.h"
+#include "transport.h"
+
+#ifndef __BITBANG_HEADER__
+#define __BITBANG_HEADER__
+
+/*
+ * ICSP bit-banged on the Pi's GPIO. This is the only transport that maps
+ * /dev/mem, and only once one is constructed.
+ */
+class BitBang final : public Transport{
+public:
+	BitBang(){
+		Timing::calibrate();
+	}
+	inline void edge( uint32_t set, uint32_t clr ){
+		Pin::drive( set, clr );
+	}
+	inline void hold( nsec_t ns ){
+		Timing::wait( ns );
+	}
+	void write( uint32_t word, unsigned int numberofbits ){
+		m_clock.setDirection(Pin::OUTPUT);
+		m_data.setDirection(Pin::OUTPUT);
+		shiftOut( *this, word, numberofbits );
+	}
+	uint32_t read( unsigned int numberofbits ){
+		uint32_t ret = 0;
+		m_clock.setDirection(Pin::OUTPUT);
+		m_data.setDirection(Pin::INPUT);
+		for( int i = numberofbits - 1; i >= 0; i-- ){
+
+			edge( LINE_CLOCK, 0 );
+			hold( TCKH );
+
+			edge( 0, LINE_CLOCK );
+			if( Pin::levels() & LINE_DATA ) ret |= 1 << i;
+			hold( TCKL );
+		}
+		return ret;
+	}
+	void outputs(){
+		m_mclr.setDirection(Pin::OUTPUT);
+		m_clock.setDirection(Pin::OUTPUT);
+		m_data.setDirection(Pin::OUTPUT);
+		m_pwr.setDirection(Pin::OUTPUT);
+	}
+
+	void invalidate(){
+		m_mclr.invalidate();
+		m_clock.invalidate();
+		m_data.invalidate();
+		m_pwr.invalidate();
+	}
+	void replay( const Session& s ){
+		outputs();
+		s.replay();
+	}
+private:
+	GPIOPin<GPIO_CLOCK> m_clock;
+	GPIOPin<GPIO_DATA>  m_data;
+	GPIOPin<GPIO_MCLR>  m_mclr;
+	GPIOPin<GPIO_POWER> m_pwr;
+};
+
+#endif
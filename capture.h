@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "pic.h"
+#include "timing.h"
+#include "transport.h"
+#include "realtime.h"
+
+#ifndef __CAPTURE_HEADER__
+#define __CAPTURE_HEADER__
+
+#define CAPTURE_MAX (1 << 20)	//level changes kept
+
+/*
+ * Poor man's logic analyzer on GPLEV0.
+ *
+ * A second thread, pinned to another core, reads GPLEV0 in a tight loop
+ * and timestamps every change on the MCLR/CLK/DAT/PWR lines into a
+ * preallocated buffer. It runs SCHED_OTHER whatever the caller runs at,
+ * so it never holds off a -r wire thread. Afterwards the buffer can be
+ * written as a VCD for GTKWave, and measure() reports the narrowest
+ * clock high/low, the shortest data setup before and hold after each
+ * falling clock edge, and the loop's sample period, which bounds how
+ * much those numbers can be trusted.
+ */
+class Capture{
+public:
+	typedef struct sample{
+		nsec_t   t;
+		uint32_t levels;
+	}Sample;
+
+	Capture(){
+		m_samples.reserve( CAPTURE_MAX );
+		m_running.store( false );
+		m_cpu = -1;
+		m_loops = 0;
+		m_dropped = 0;
+	}
+	~Capture(){
+		stop();
+	}
+
+	void start( int cpu = -1 ){
+		Pin::pinout.init();
+		m_samples.clear();
+		m_dropped = 0;
+		m_loops = 0;
+		m_cpu = cpu;
+		m_running.store( true );
+		m_thread = std::thread( &Capture::run, this );
+	}
+	void stop(){
+		if( !m_running.load() ) return;
+		m_running.store( false );
+		m_thread.join();
+	}
+
+	bool vcd( const char* path ) const{
+		FILE* fp = fopen( path, "w" );
+		if( fp == NULL ){
+			fprintf(stderr, "Cannot write %s\n", path);
+			return false;
+		}
+		static const char id[] = { '!', '"', '#', '$' };
+		static const char* name[] = { "MCLR", "CLK", "DAT", "PWR" };
+		fprintf(fp, "$timescale 1ns $end\n$scope module icsp $end\n");
+		for( int i = 0; i < 4; i++ ) fprintf(fp, "$var wire 1 %c %s $end\n", id[i], name[i]);
+		fprintf(fp, "$upscope $end\n$enddefinitions $end\n");
+		if( !m_samples.empty() ){
+			nsec_t t0 = m_samples[0].t;
+			uint32_t last = ~m_samples[0].levels;
+			for( size_t s = 0; s < m_samples.size(); s++ ){
+				const Sample& x = m_samples[s];
+				fprintf(fp, "#%" PRIu64 "\n", x.t - t0);
+				for( int i = 0; i < 4; i++ ){
+					if( (x.levels ^ last) & s_line[i] ) fprintf(fp, "%d%c\n", (x.levels & s_line[i]) ? 1 : 0, id[i]);
+				}
+				last = x.levels;
+			}
+		}
+		fclose( fp );
+		fprintf(stdout, "Capture: %zu changes written to %s\n", m_samples.size(), path);
+		return true;
+	}
+
+	void measure( FILE* fp ) const{
+		nsec_t high = ~(nsec_t)0, low = ~(nsec_t)0, setup = ~(nsec_t)0, hold = ~(nsec_t)0;
+		nsec_t rise = 0, fall = 0, datat = 0;
+		bool awaithold = false;
+		for( size_t s = 1; s < m_samples.size(); s++ ){
+			uint32_t was = m_samples[s - 1].levels, is = m_samples[s].levels;
+			nsec_t t = m_samples[s].t;
+			if( (was ^ is) & LINE_DATA ){
+				if( awaithold && t - fall < hold ) hold = t - fall;
+				awaithold = false;
+				datat = t;
+			}
+			if( !(was & LINE_CLOCK) && (is & LINE_CLOCK) ){
+				if( fall && t - fall < low ) low = t - fall;
+				rise = t;
+			}
+			if( (was & LINE_CLOCK) && !(is & LINE_CLOCK) ){
+				if( rise && t - rise < high ) high = t - rise;
+				if( datat && t - datat < setup ) setup = t - datat;
+				fall = t;
+				awaithold = true;
+			}
+		}
+		nsec_t span = m_samples.size() > 1 ? m_samples.back().t - m_samples[0].t : 0;
+		fprintf(fp, "Capture: %zu changes, %" PRIu64 " dropped, sample period %.1f ns\n",
+				m_samples.size(), m_dropped, m_loops ? (double)span / m_loops : 0.0);
+		report( fp, "TCKH clock high", high, TCKH );
+		report( fp, "TCKL clock low ", low, TCKL );
+		report( fp, "TDS  data setup", setup, TDS );
+		report( fp, "TDH  data hold ", hold, TDH );
+	}
+
+private:
+	void run(){
+		Realtime::background();
+		/* The -r pin is inherited too; spinning there would starve the wire */
+		cpu_set_t set;
+		CPU_ZERO( &set );
+		if( m_cpu >= 0 ) CPU_SET( m_cpu, &set );
+		else for( long i = 0; i < sysconf( _SC_NPROCESSORS_ONLN ); i++ ) CPU_SET( i, &set );
+		if( pthread_setaffinity_np( pthread_self(), sizeof(set), &set ) != 0 ){
+			fprintf(stderr, "Capture: cannot pin to cpu %d\n", m_cpu);
+		}
+
+		const uint32_t mask = LINE_ALL;
+		uint32_t last = GPIO_LEV & mask;
+		Sample first = { Timing::now(), last };
+		m_samples.push_back( first );
+		uint64_t loops = 0;
+		while( m_running.load( std::memory_order_relaxed ) ){
+			uint32_t v = GPIO_LEV & mask;
+			loops++;
+			if( v == last ) continue;
+			last = v;
+			if( m_samples.size() == CAPTURE_MAX ){
+				m_dropped++;
+				continue;
+			}
+			Sample x = { Timing::now(), v };
+			m_samples.push_back( x );
+		}
+		m_loops = loops;
+	}
+	static void report( FILE* fp, const char* what, nsec_t got, nsec_t spec ){
+		if( got == ~(nsec_t)0 ){
+			fprintf(fp, "  %s: not seen\n", what);
+			return;
+		}
+		fprintf(fp, "  %s: min %5" PRIu64 " ns, spec %4" PRIu64 " ns, margin %+" PRId64 " ns\n",
+				what, got, spec, (int64_t)got - (int64_t)spec);
+	}
+
+	static const uint32_t s_line[4];
+
+	std::vector<Sample> m_samples;
+	std::atomic<bool> m_running;
+	int m_cpu;
+	std::thread m_thread;
+	uint64_t m_loops;
+	uint64_t m_dropped;
+};
+const uint32_t Capture::s_line[4] = { LINE_MCLR, LINE_CLOCK, LINE_DATA, LINE_POWER };
+
+#endif
@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#ifndef __DAEMON_HEADER__
+#define __DAEMON_HEADER__
+
+#define DAEMON_SOCKET "/tmp/picprog.sock"
+#define DAEMON_LINE   1024	//longest job line
+
+/*
+ * Job intake for service mode.
+ *
+ * A listener thread accepts connections on a Unix stream socket and reads
+ * one line from each; that line is the job. Jobs queue up in arrival
+ * order and next() hands them to the thread that owns the programmer, so
+ * the wire is only ever driven from one place. reply() writes one line
+ * back (structured results are the caller's business) and closes the
+ * connection.
+ *
+ * SIGINT and SIGTERM shut the listening socket down, which is all a
+ * handler may safely do; the listener then stops taking jobs and next()
+ * returns false once the queue has drained, so the owner can unwind and
+ * the destructor removes the socket file.
+ */
+class Daemon{
+public:
+	typedef struct job{
+		unsigned id;
+		int fd;
+		std::string line;
+	}Job;
+
+	Daemon( const char* path = DAEMON_SOCKET ){
+		m_path = path;
+		m_jobs = 0;
+		struct sockaddr_un addr;
+		memset( &addr, 0, sizeof(addr) );
+		addr.sun_family = AF_UNIX;
+		if( strlen( path ) >= sizeof(addr.sun_path) ){
+			fprintf(stderr, "Socket path %s too long\n", path);
+			exit(EXIT_FAILURE);
+		}
+		strcpy( addr.sun_path, path );
+		unlink( path );
+		if( (m_fd = socket( AF_UNIX, SOCK_STREAM, 0 )) < 0 ||
+				bind( m_fd, (struct sockaddr*)&addr, sizeof(addr) ) < 0 ||
+				::listen( m_fd, 16 ) < 0 ){
+			fprintf(stderr, "%s: %s\n", path, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		m_closed = false;
+		s_fd = m_fd;
+		struct sigaction sa;
+		memset( &sa, 0, sizeof(sa) );
+		sa.sa_handler = stop;
+		sigemptyset( &sa.sa_mask );
+		sigaction( SIGINT, &sa, &m_int );
+		sigaction( SIGTERM, &sa, &m_term );
+		m_listener = std::thread( &Daemon::accepting, this );
+		fprintf(stdout, "Listening on %s\n", path);
+	}
+	~Daemon(){
+		stop( 0 );
+		m_listener.join();
+		sigaction( SIGINT, &m_int, NULL );
+		sigaction( SIGTERM, &m_term, NULL );
+		s_fd = -1;
+		close( m_fd );
+		unlink( m_path.c_str() );
+	}
+
+	/* Block until a job is queued; false once stopped and drained */
+	bool next( Job& j ){
+		std::unique_lock<std::mutex> lock( m_lock );
+		m_ready.wait( lock, [this]{ return !m_queue.empty() || m_closed; } );
+		if( m_queue.empty() ) return false;
+		j = m_queue.front();
+		m_queue.pop_front();
+		return true;
+	}
+	size_t queued(){
+		std::lock_guard<std::mutex> lock( m_lock );
+		return m_queue.size();
+	}
+	void reply( Job& j, const std::string& result ){
+		std::string out = result + "\n";
+		const char* p = out.c_str();
+		size_t left = out.size();
+		while( left > 0 ){
+			ssize_t n = write( j.fd, p, left );
+			if( n < 0 && errno == EINTR ) continue;
+			if( n <= 0 ) break;	//client went away, the job still ran
+			p += n;
+			left -= n;
+		}
+		close( j.fd );
+		j.fd = -1;
+	}
+
+private:
+	void accepting(){
+		for( ;; ){
+			int fd = accept( m_fd, NULL, NULL );
+			if( fd < 0 ){
+				if( errno == EINTR ) continue;
+				std::lock_guard<std::mutex> lock( m_lock );
+				m_closed = true;
+				m_ready.notify_one();
+				return;
+			}
+			Job j;
+			j.fd = fd;
+			if( !readLine( fd, j.line ) ){
+				close( fd );
+				continue;
+			}
+			std::lock_guard<std::mutex> lock( m_lock );
+			j.id = ++m_jobs;
+			m_queue.push_back( j );
+			m_ready.notify_one();
+		}
+	}
+	/* Signal handler: wakes accept() with an error */
+	static void stop( int ){
+		if( s_fd >= 0 ) shutdown( s_fd, SHUT_RDWR );
+	}
+	static bool readLine( int fd, std::string& line ){
+		char c;
+		while( line.size() < DAEMON_LINE ){
+			ssize_t n = read( fd, &c, 1 );
+			if( n < 0 && errno == EINTR ) continue;
+			if( n <= 0 ) return !line.empty();
+			if( c == '\n' ) return true;
+			if( c != '\r' ) line += c;
+		}
+		return true;
+	}
+
+	std::string m_path;
+	int m_fd;
+	unsigned m_jobs;
+	std::thread m_listener;
+	std::mutex m_lock;
+	std::condition_variable m_ready;
+	std::deque<Job> m_queue;
+	bool m_closed;
+	struct sigaction m_int, m_term;
+	static int s_fd;
+};
+int Daemon::s_fd = -1;
+
+#endif
@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "image.h"
+
+#ifndef __DEVICE_HEADER__
+#define __DEVICE_HEADER__
+
+#define DEVICE_MAXROW 128	//largest erase row / latch count we handle
+#define DIA       0x8100	//device information area
+#define DIA_WORDS 32
+#define EEPROM    0xf000	//data EEPROM, one byte per word
+
+/* What the DCI can't tell us: the name, and the size to expect */
+typedef struct part{
+	uint16_t id;
+	const char* name;
+	uint32_t words;
+	uint16_t eeprom;	//bytes
+}Part;
+
+/* PIC16F152xx: tens digit is the package (8 to 40 pins), last digit the
+ * flash size (3.5 to 28 KB). 32 word rows, no data EEPROM. */
+const Part PARTS[] = {
+	{ 0x30e3, "PIC16F15213",  2048, 0 },
+	{ 0x30e4, "PIC16F15214",  4096, 0 },
+	{ 0x30e5, "PIC16F15223",  2048, 0 },
+	{ 0x30e6, "PIC16F15224",  4096, 0 },
+	{ 0x30e7, "PIC16F15225",  8192, 0 },
+	{ 0x30e8, "PIC16F15243",  2048, 0 },
+	{ 0x30e9, "PIC16F15244",  4096, 0 },
+	{ 0x30ea, "PIC16F15245",  8192, 0 },
+	{ 0x30eb, "PIC16F15254",  4096, 0 },
+	{ 0x30ec, "PIC16F15255",  8192, 0 },
+	{ 0x30ed, "PIC16F15256", 16384, 0 },
+	{ 0x30ee, "PIC16F15274",  4096, 0 },
+	{ 0x30ef, "PIC16F15275",  8192, 0 },
+	{ 0x30f0, "PIC16F15276", 16384, 0 },
+};
+
+/*
+ * Memory geometry of the part in the socket.
+ *
+ * Built from the Device Configuration Information at 0x8200: erase row
+ * size, write latches, user erasable rows, EEPROM size and pin count.
+ * The DCI is what we program by; the table only supplies a name and is
+ * cross-checked. Until fromDCI() succeeds the geometry is that of a
+ * PIC16F15256, which is also what compiled sessions assume.
+ */
+class Device{
+public:
+	Device(){
+		m_id = 0;
+		m_ersiz = 32;
+		m_wlsiz = 32;
+		m_ursiz = 512;
+		m_eesiz = 0;
+		m_pcnt = 28;
+		m_part = NULL;
+	}
+
+	/* dci[] holds the five words at 0x8200. Returns false, keeping the
+	 * previous geometry, if they make no sense */
+	bool fromDCI( uint16_t id, const uint16_t* dci ){
+		m_id = id;
+		m_part = lookup( id );
+		uint16_t ersiz = dci[0], wlsiz = dci[1], ursiz = dci[2];
+		if( ersiz == 0 || ersiz > DEVICE_MAXROW || ( ersiz & (ersiz - 1) ) ||
+				wlsiz == 0 || wlsiz > ersiz || ersiz % wlsiz ||
+				ursiz == 0 || (uint32_t)ursiz * ersiz > MAXWORDS ){
+			fprintf(stderr, "DCI %04x %04x %04x makes no sense, assuming %u word rows\n",
+					ersiz, wlsiz, ursiz, m_ersiz);
+			return false;
+		}
+		m_ersiz = ersiz;
+		m_wlsiz = wlsiz;
+		m_ursiz = ursiz;
+		m_eesiz = dci[3];
+		m_pcnt = dci[4];
+		if( m_part && ( m_part->words != words() || m_part->eeprom != m_eesiz ) ){
+			fprintf(stderr, "%s: DCI says %u words/%u bytes EEPROM, expected %u/%u\n",
+					m_part->name, words(), m_eesiz, m_part->words, m_part->eeprom);
+		}
+		return true;
+	}
+
+	static const Part* lookup( uint16_t id ){
+		for( size_t i = 0; i < sizeof(PARTS) / sizeof(PARTS[0]); i++ ){
+			if( PARTS[i].id == id ) return &PARTS[i];
+		}
+		return NULL;
+	}
+
+	const char* name() const{ return m_part ? m_part->name : "unknown part"; }
+	/* Erase granularity in words */
+	uint32_t rowsize() const{ return m_ersiz; }
+	/* Words programmed per BEGININTPROGRAM */
+	uint32_t latches() const{ return m_wlsiz; }
+	uint32_t rows() const{ return m_ursiz; }
+	/* Program flash in words */
+	uint32_t words() const{ return (uint32_t)m_ursiz * m_ersiz; }
+	uint32_t eeprom() const{ return m_eesiz; }
+	uint32_t pins() const{ return m_pcnt; }
+
+	void print( FILE* fp ) const{
+		fprintf(fp, "%s: %u words flash, %u bytes EEPROM, %u pins\n", name(), words(), m_eesiz, m_pcnt);
+		fprintf(fp, "Erase Row Size: %d words\n", m_ersiz);
+		fprintf(fp, "Number of write latches per row: %d words\n", m_wlsiz);
+		fprintf(fp, "Number of user erasable rows: %d rows\n", m_ursiz);
+	}
+
+private:
+	uint16_t m_id;
+	uint16_t m_ersiz;
+	uint16_t m_wlsiz;
+	uint16_t m_ursiz;
+	uint16_t m_eesiz;
+	uint16_t m_pcnt;
+	const Part* m_part;
+};
+
+#endif
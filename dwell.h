@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <string>
+#include <vector>
+
+#include "timing.h"
+
+#ifndef __DWELL_HEADER__
+#define __DWELL_HEADER__
+
+#define DWELL_PROFILE ".picprog-dwell"	//under $HOME
+#define DWELL_STEPS   64	//search resolution, fraction of the spec value
+#define DWELL_TRIALS  4		//rows that must all verify per candidate
+
+/* Self-timed dwells, spec maximums unless a part was calibrated */
+typedef struct dwell{
+	nsec_t erab;	//bulk erase
+	nsec_t erar;	//row erase
+	nsec_t pint;	//internally timed programming
+	nsec_t pext;	//externally timed programming
+}Dwell;
+
+const Dwell SPEC_DWELL = { TERAB, TERAR, TPINT, TPEXT };
+
+/*
+ * Calibrated dwells on disk, one line per device ID and revision:
+ *
+ *   <devid> <rev> <erab> <erar> <pint> <pext>
+ *
+ * ids in hex, dwells in ns. save() rewrites the file with the line for
+ * this part replaced.
+ */
+class Profile{
+public:
+	static bool load( uint16_t devid, uint16_t rev, Dwell& d ){
+		FILE* fp = fopen( path().c_str(), "r" );
+		if( fp == NULL ) return false;
+		char line[128];
+		bool found = false;
+		while( !found && fgets( line, sizeof(line), fp ) ){
+			unsigned id, r;
+			uint64_t v[4];
+			if( sscanf( line, "%x %x %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64,
+					&id, &r, &v[0], &v[1], &v[2], &v[3] ) != 6 ) continue;
+			if( id != devid || r != rev ) continue;
+			d.erab = v[0];
+			d.erar = v[1];
+			d.pint = v[2];
+			d.pext = v[3];
+			found = true;
+		}
+		fclose( fp );
+		return found;
+	}
+	static bool save( uint16_t devid, uint16_t rev, const Dwell& d ){
+		std::vector<std::string> keep;
+		FILE* fp = fopen( path().c_str(), "r" );
+		if( fp ){
+			char line[128];
+			while( fgets( line, sizeof(line), fp ) ){
+				unsigned id, r;
+				if( sscanf( line, "%x %x", &id, &r ) == 2 && id == devid && r == rev ) continue;
+				keep.push_back( line );
+			}
+			fclose( fp );
+		}
+		std::string tmp = path() + ".new";
+		if( (fp = fopen( tmp.c_str(), "w" )) == NULL ){
+			fprintf(stderr, "Cannot write %s\n", tmp.c_str());
+			return false;
+		}
+		for( size_t i = 0; i < keep.size(); i++ ) fputs( keep[i].c_str(), fp );
+		fprintf(fp, "%04x %04x %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+				devid, rev, d.erab, d.erar, d.pint, d.pext);
+		fclose( fp );
+		if( rename( tmp.c_str(), path().c_str() ) < 0 ){
+			fprintf(stderr, "Cannot replace %s\n", path().c_str());
+			return false;
+		}
+		fprintf(stdout, "Saved dwells for %04x rev. %04x to %s\n", devid, rev, path().c_str());
+		return true;
+	}
+
+	static void print( FILE* fp, const Dwell& d ){
+		fprintf(fp, "Dwells: erase %" PRIu64 "/%" PRIu64 " us, program %" PRIu64 "/%" PRIu64 " us\n",
+				d.erab / USEC, d.erar / USEC, d.pint / USEC, d.pext / USEC);
+	}
+
+private:
+	static std::string path(){
+		const char* home = getenv( "HOME" );
+		return std::string( home ? home : "." ) + "/" + DWELL_PROFILE;
+	}
+};
+
+#endif
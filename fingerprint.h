@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "image.h"
+
+#ifndef __FINGERPRINT_HEADER__
+#define __FINGERPRINT_HEADER__
+
+/*
+ * Image fingerprint kept in the four user ID words.
+ *
+ * A 64-bit FNV-1a over the address and value of every programmed
+ * (non-erased) word in address order, then the five config words, folded
+ * to 56 bits and split 14 per user ID word. Erased words are skipped so
+ * the result does not depend on how the image is grouped into rows. A
+ * board whose user IDs and config read back equal to the stamp already
+ * holds this image, barring a stale stamp, which sample() helps catch.
+ */
+class Fingerprint{
+public:
+	static void stamp( const Image& img, const uint32_t* config, uint32_t* userid ){
+		uint64_t h = 0xcbf29ce484222325ull;
+		for( uint32_t r = img.first(); r != Image::NOROW; r = img.next( r ) ){
+			const uint32_t* w = img.row( r );
+			for( uint32_t i = 0; i < img.rowsize(); i++ ){
+				if( w[i] == ERASED ) continue;
+				h = mix( h, r * img.rowsize() + i );
+				h = mix( h, w[i] );
+			}
+		}
+		for( int i = 0; i < 5; i++ ) h = mix( h, config[i] );
+		h ^= h >> 56;
+		for( int i = 0; i < 4; i++ ){
+			userid[i] = ( h >> (14 * i) ) & 0x3fff;
+		}
+		if( userid[0] == ERASED && userid[1] == ERASED && userid[2] == ERASED && userid[3] == ERASED ){
+			userid[0] ^= 1;	//never look like a blank part
+		}
+	}
+
+	/* Up to n present rows spread evenly over the image, for a spot check
+	 * that the flash still holds what the stamp claims */
+	static Image sample( const Image& img, uint32_t n ){
+		Image s( img.rowsize() );
+		uint32_t rows = img.rows();
+		if( n == 0 || rows == 0 ) return s;
+		if( n > rows ) n = rows;
+		uint32_t k = 0, taken = 0;
+		for( uint32_t r = img.first(); r != Image::NOROW && taken < n; r = img.next( r ), k++ ){
+			if( k * n < taken * rows ) continue;
+			s.load( img.row( r ), img.rowsize(), r * img.rowsize() );
+			taken++;
+		}
+		return s;
+	}
+
+	static void print( FILE* fp, const uint32_t* userid ){
+		fprintf(fp, "Fingerprint %04x %04x %04x %04x\n", userid[0], userid[1], userid[2], userid[3]);
+	}
+
+private:
+	static inline uint64_t mix( uint64_t h, uint32_t v ){
+		for( int i = 0; i < 2; i++ ){
+			h ^= ( v >> (8 * i) ) & 0xff;
+			h *= 0x100000001b3ull;
+		}
+		return h;
+	}
+};
+
+#endif
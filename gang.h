@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "pic.h"
+#include "timing.h"
+#include "instructions.h"
+#include "device.h"
+
+#ifndef __GANG_HEADER__
+#define __GANG_HEADER__
+
+#define GANG_MAX 24
+#define GANG_PINS 28	//BCM GPIO 0-27 are on the header and in GPLEV0
+
+/*
+ * Gang programmer: up to GANG_MAX targets clocked in lockstep.
+ *
+ * Clock, MCLR and power are masks, so they may be one shared line or one
+ * line per socket; they are always driven together. Every target has its
+ * own data line. Writes are broadcast with one GPIO_SET/GPIO_CLR store
+ * per edge, reads sample all data lines with a single GPLEV0 load per bit
+ * and are demultiplexed after the transfer. A target that fails a verify
+ * is marked dead but keeps being clocked with the others. The row size
+ * comes from the DCI of the first target found; a target whose DCI
+ * differs is marked dead, since all targets share one row layout.
+ */
+class Gang{
+public:
+	Gang( const uint8_t* data, int n,
+			uint32_t mclr  = 1u << GPIO_MCLR,
+			uint32_t clock = 1u << GPIO_CLOCK,
+			uint32_t power = 1u << GPIO_POWER ){
+		if( n < 1 || n > GANG_MAX ){
+			fprintf(stderr, "Gang size must be 1-%d\n", GANG_MAX);
+			exit(EXIT_FAILURE);
+		}
+		Pin::pinout.init();
+		m_n = n;
+		m_mclr = mclr;
+		m_clock = clock;
+		m_power = power;
+		m_data = 0;
+		for( int i = 0; i < n; i++ ){
+			m_pin[i] = data[i];
+			m_data |= 1u << data[i];
+			m_id[i] = 0;
+		}
+		m_alive = (1u << n) - 1;
+		m_input = false;
+		Timing::calibrate();
+		Pin::setDirection( m_mclr | m_clock | m_power | m_data, Pin::OUTPUT );
+	}
+	~Gang(){
+	}
+
+	/* False, with the reason, if pin can't be a data line next to the
+	 * n already in data[] */
+	static bool usable( long pin, const uint8_t* data, int n ){
+		if( pin < 0 || pin >= GANG_PINS ){
+			fprintf(stderr, "Gang data GPIO %ld out of range 0-%d\n", pin, GANG_PINS - 1);
+			return false;
+		}
+		if( pin == GPIO_MCLR || pin == GPIO_CLOCK || pin == GPIO_POWER ){
+			fprintf(stderr, "Gang data GPIO %ld is the MCLR, clock or power line\n", pin);
+			return false;
+		}
+		for( int i = 0; i < n; i++ ){
+			if( data[i] == pin ){
+				fprintf(stderr, "Gang data GPIO %ld listed twice\n", pin);
+				return false;
+			}
+		}
+		return true;
+	}
+
+	int size(){ return m_n; }
+	/* Bit t is set while target t is present and has passed every verify */
+	uint32_t alive(){ return m_alive; }
+
+	void start(){
+		vppFirstEntry();
+		enterLVP();
+		uint32_t ids[GANG_MAX];
+		setPC( 0x8006 );
+		readNVM( ids );
+		for( int t = 0; t < m_n; t++ ){
+			m_id[t] = ids[t];
+			if( ids[t] == 0x0000 || ids[t] == 0x3fff ){
+				fprintf(stdout, "Socket %d: no device\n", t);
+				m_alive &= ~(1u << t);
+			}
+			else fprintf(stdout, "Socket %d: device %04x\n", t, ids[t]);
+		}
+		getDCI();
+	}
+	const Device& device(){
+		return m_device;
+	}
+	void stop(){
+		vppFirstExit();
+	}
+	void powerOn(){
+		output();
+		Pin::drive( m_mclr | m_power, 0 );
+	}
+
+	void setPC( uint32_t address ){
+		write( Instructions::SETPC );
+		Timing::wait( TDLY );
+		write( address << STOPBIT, PAYLOADSZ );
+		Timing::wait( TDLY );
+	}
+	void incPC(){
+		write( Instructions::INCPC );
+		Timing::wait( TDLY );
+	}
+	void bulkErase(){
+		write( Instructions::BULKERASE );
+		Timing::wait( TERAB );
+	}
+	void beginIntProgramming(){
+		write( Instructions::BEGININTPROGRAM );
+		Timing::wait( TPINT );
+	}
+	void writeNVM( uint32_t data ){
+		write( Instructions::LOADNVM );
+		Timing::wait( TDLY );
+		write( data << STOPBIT, PAYLOADSZ );
+		Timing::wait( TDLY );
+	}
+	/* One word per target, PC unchanged */
+	void readNVM( uint32_t* data ){
+		write( Instructions::READNVM );
+		Timing::wait( TDLY );
+		read( data );
+		Timing::wait( TDLY );
+	}
+
+	/* Program one erase row into every target, a latch group at a time,
+	 * and verify each one */
+	bool writeRow( uint32_t address, const uint32_t* data, size_t sz ){
+		if( sz != m_device.rowsize() ){
+			fprintf(stderr, "Row of %zu words, the parts erase %u\n", sz, m_device.rowsize());
+			return false;
+		}
+		uint32_t latches = m_device.latches();
+		uint32_t ret[GANG_MAX];
+		for( uint32_t at = 0; at < sz; at += latches ){
+			setPC( address + at );
+			for( unsigned int i = 0; i < latches; i++ ){
+				write( Instructions::LOADNVM_INCPC );
+				Timing::wait( TDLY );
+				write( data[at + i] << STOPBIT, PAYLOADSZ );
+				Timing::wait( TDLY );
+			}
+			setPC( address + at );
+			beginIntProgramming();
+			for( unsigned int i = 0; i < latches; i++ ){
+				write( Instructions::READNVM_INCPC );
+				Timing::wait( TDLY );
+				read( ret );
+				Timing::wait( TDLY );
+				check( ret, data[at + i], 0x3fff, address + at + i );
+			}
+		}
+		return m_alive != 0;
+	}
+
+	/* Program the word at the PC, verify the bits in mask, advance the PC */
+	bool writeWord( uint32_t word, uint32_t mask ){
+		writeNVM( word );
+		beginIntProgramming();
+		uint32_t ret[GANG_MAX];
+		readNVM( ret );
+		check( ret, word, mask, 0 );
+		incPC();
+		return m_alive != 0;
+	}
+
+	void report( FILE* fp ){
+		for( int t = 0; t < m_n; t++ ){
+			fprintf(fp, "Socket %d [GPIO %d]: %s\n", t, m_pin[t],
+					( m_alive & (1u << t) ) ? "PASS" : "FAIL" );
+		}
+	}
+
+protected:
+	void write( uint32_t word, unsigned int numberofbits = 8 ){
+		output();
+		for( int i = numberofbits - 1; i >= 0; i-- ){
+			if( (word >> i) & 0x0001 ) Pin::drive( m_clock | m_data, 0 );
+			else Pin::drive( m_clock, m_data );
+			Timing::wait( TCKH );
+
+			Pin::drive( 0, m_clock );
+			Timing::wait( TCKL );
+		}
+	}
+	/* One GPLEV0 load per bit for all targets, demultiplexed afterwards */
+	void read( uint32_t* words, unsigned int numberofbits = PAYLOADSZ ){
+		uint32_t lev[32];
+		input();
+		for( int i = numberofbits - 1; i >= 0; i-- ){
+			Pin::drive( m_clock, 0 );
+			Timing::wait( TCKH );
+
+			Pin::drive( 0, m_clock );
+			lev[i] = Pin::levels();
+			Timing::wait( TCKL );
+		}
+		for( int t = 0; t < m_n; t++ ){
+			uint32_t ret = 0;
+			for( int i = numberofbits - 1; i >= 0; i-- ){
+				ret |= ( ( lev[i] >> m_pin[t] ) & 1 ) << i;
+			}
+			//Ignore start and stop bit
+			ret &= ~(0x01 << (numberofbits - 1));
+			words[t] = ret >> 1;
+		}
+	}
+
+	void vppFirstEntry(){
+		output();
+		Pin::drive( 0, m_mclr | m_clock | m_data | m_power );
+
+		Pin::drive( m_mclr, 0 );
+		Timing::wait(TENTS);
+		Pin::drive( m_power, 0 );
+		Timing::wait(TENTH);
+		Pin::drive( m_data | m_clock, 0 );
+		Timing::wait(TCKH);
+		Pin::drive( 0, m_clock );
+		Timing::wait(TCKL);
+
+		Timing::wait(10 * MSEC);
+	}
+	void enterLVP(){
+		Timing::wait(TENTS);
+		Pin::drive( 0, m_mclr );
+		Timing::wait(TENTH);
+
+		write( 0x4d434850, 32 );
+		Timing::wait(TENTH);
+	}
+	void vppFirstExit(){
+		output();
+		Pin::drive( 0, m_clock );
+		Timing::wait(TCKL);
+		Pin::drive( m_clock, 0 );
+		Timing::wait(TCKH);
+		Pin::drive( 0, m_clock | m_data | m_power );
+		Timing::wait(TEXIT);
+		Pin::drive( 0, m_mclr );
+	}
+
+private:
+	/* Geometry from the first live target's DCI; the rest must match */
+	void getDCI(){
+		uint32_t ret[GANG_MAX];
+		uint16_t dci[GANG_MAX][5];
+		setPC( 0x8200 );
+		for( int i = 0; i < 5; i++ ){
+			readNVM( ret );
+			for( int t = 0; t < m_n; t++ ) dci[t][i] = ret[t];
+			incPC();
+		}
+		int first = -1;
+		for( int t = 0; t < m_n; t++ ){
+			if( !( m_alive & (1u << t) ) ) continue;
+			if( first < 0 ){
+				first = t;
+				m_device.fromDCI( m_id[t], dci[t] );
+			}
+			else if( memcmp( dci[t], dci[first], sizeof(dci[t]) ) != 0 ){
+				fprintf(stderr, "Socket %d: DCI differs from socket %d\n", t, first);
+				m_alive &= ~(1u << t);
+			}
+		}
+	}
+	void check( const uint32_t* ret, uint32_t want, uint32_t mask, uint32_t address ){
+		for( int t = 0; t < m_n; t++ ){
+			if( !( m_alive & (1u << t) ) ) continue;
+			if( ( ret[t] & mask ) != ( want & mask ) ){
+				fprintf(stderr, "Socket %d: verify failed at %04x (%04x != %04x)\n",
+						t, address, ret[t], want );
+				m_alive &= ~(1u << t);
+			}
+		}
+	}
+	inline void output(){
+		if( !m_input ) return;
+		Pin::setDirection( m_data, Pin::OUTPUT );
+		m_input = false;
+	}
+	inline void input(){
+		if( m_input ) return;
+		Pin::setDirection( m_data, Pin::INPUT );
+		m_input = true;
+	}
+
+	int m_n;
+	uint8_t  m_pin[GANG_MAX];
+	uint16_t m_id[GANG_MAX];
+	uint32_t m_data;
+	uint32_t m_clock;
+	uint32_t m_mclr;
+	uint32_t m_power;
+	uint32_t m_alive;
+	bool m_input;
+	Device m_device;
+};
+
+#endif
@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "image.h"
+
+#ifndef __HEX_HEADER__
+#define __HEX_HEADER__
+
+/*
+ * Intel HEX (INHX32) as written by XC8/MPASM.
+ *
+ * load() maps the file and parses it in one pass straight into an Image:
+ * byte address A is half of word A/2, low byte first. Program memory,
+ * user IDs (0x8000) and config words (0x8007-0x800b) are kept; anything
+ * else (device ID, EEPROM, ...) is counted and reported. Every record's
+ * checksum is validated.
+ */
+class Hex{
+public:
+	static bool load( const char* path, Image& img ){
+		int fd = open( path, O_RDONLY );
+		if( fd < 0 ){
+			fprintf(stderr, "Cannot open %s\n", path);
+			return false;
+		}
+		struct stat st;
+		if( fstat( fd, &st ) < 0 || st.st_size == 0 ){
+			fprintf(stderr, "%s: empty file\n", path);
+			close( fd );
+			return false;
+		}
+		void* map = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0 );
+		close( fd );
+		if( map == MAP_FAILED ){
+			fprintf(stderr, "%s: mmap failed\n", path);
+			return false;
+		}
+		const char* p = (const char*)map;
+		bool ok = parse( p, p + st.st_size, img, path );
+		munmap( map, st.st_size );
+		return ok;
+	}
+
+	static bool parse( const char* p, const char* end, Image& img, const char* name = "hex" ){
+		uint32_t base = 0;
+		uint32_t skipped = 0;
+		int line = 1;
+		bool eof = false;
+		img.clear();
+		while( p < end && !eof ){
+			if( *p == '\n' ){ line++; p++; continue; }
+			if( *p == '\r' || *p == ' ' || *p == '\t' ){ p++; continue; }
+			if( *p++ != ':' ){
+				fprintf(stderr, "%s:%d: expected ':'\n", name, line);
+				return false;
+			}
+			int count, hi, lo, type;
+			if( end - p < 10 || (count = byte( p )) < 0 || (hi = byte( p + 2 )) < 0 ||
+					(lo = byte( p + 4 )) < 0 || (type = byte( p + 6 )) < 0 ){
+				fprintf(stderr, "%s:%d: bad record header\n", name, line);
+				return false;
+			}
+			p += 8;
+			if( end - p < count * 2 + 2 ){
+				fprintf(stderr, "%s:%d: truncated record\n", name, line);
+				return false;
+			}
+			if( ( type == 0x02 || type == 0x04 ) && count != 2 ){
+				fprintf(stderr, "%s:%d: address record with %d data bytes, expected 2\n", name, line, count);
+				return false;
+			}
+			uint8_t sum = count + hi + lo + type;
+			uint32_t address = base + ( (hi << 8) | lo );
+			const char* data = p;
+			for( int i = 0; i < count; ){
+				int b = byte( p );
+				int h = ( i + 1 < count ) ? byte( p + 2 ) : -1;
+				if( b < 0 || ( i + 1 < count && h < 0 ) ){
+					fprintf(stderr, "%s:%d: bad hex digit\n", name, line);
+					return false;
+				}
+				if( h >= 0 && !( (address + i) & 1 ) ){
+					/* Whole word in one go, the common case */
+					sum += b + h;
+					if( type == 0x00 && !img.set( (address + i) >> 1, b | (h << 8) ) ) skipped += 2;
+					i += 2;
+					p += 4;
+					continue;
+				}
+				sum += b;
+				if( type == 0x00 && !put( img, address + i, b ) ) skipped++;
+				i++;
+				p += 2;
+			}
+			int check = byte( p );
+			p += 2;
+			if( check < 0 || (uint8_t)(sum + check) != 0 ){
+				fprintf(stderr, "%s:%d: checksum mismatch\n", name, line);
+				return false;
+			}
+			switch( type ){
+				case 0x00: break;
+				case 0x01: eof = true; break;
+				case 0x02: base = ( (byte( data ) << 8) | byte( data + 2 ) ) << 4; break;
+				case 0x04: base = ( (byte( data ) << 8) | byte( data + 2 ) ) << 16; break;
+				case 0x03: case 0x05: break; //start address, meaningless here
+				default:
+					fprintf(stderr, "%s:%d: unknown record type %02x\n", name, line, type);
+					return false;
+			}
+		}
+		if( !eof ){
+			fprintf(stderr, "%s: missing end of file record\n", name);
+			return false;
+		}
+		if( skipped ){
+			fprintf(stderr, "%s: %u bytes outside program/user ID/config ignored\n", name, skipped);
+		}
+		return true;
+	}
+
+private:
+	static inline int nibble( char c ){
+		static const int8_t digit[256] = {
+			-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+			-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+			-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+			 0, 1, 2, 3, 4, 5, 6, 7, 8, 9,-1,-1,-1,-1,-1,-1,
+			-1,10,11,12,13,14,15,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+			-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+			-1,10,11,12,13,14,15,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+			-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+			-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+			-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+			-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+			-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+			-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+			-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+			-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+			-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
+		};
+		return digit[(uint8_t)c];
+	}
+	static inline int byte( const char* p ){
+		int h = nibble( p[0] ), l = nibble( p[1] );
+		if( h < 0 || l < 0 ) return -1;
+		return (h << 4) | l;
+	}
+	/* Merge one byte into its word */
+	static inline bool put( Image& img, uint32_t byteaddr, uint8_t b ){
+		uint32_t word = byteaddr >> 1;
+		uint32_t cur = img.get( word );
+		if( byteaddr & 1 ) cur = ( cur & 0x00ff ) | ( b << 8 );
+		else cur = ( cur & 0xff00 ) | b;
+		return img.set( word, cur );
+	}
+};
+
+/*
+ * INHX32 output, the inverse of Hex::load(): word A goes to byte address
+ * 2A, low byte first, 16 data bytes per record, with an extended linear
+ * address record whenever the upper 16 bits change.
+ */
+class HexWriter{
+public:
+	HexWriter( FILE* fp ){
+		m_fp = fp;
+		m_upper = 0;
+	}
+	/* n words from address on. With skipblank, records that would hold
+	 * only erased words are left out */
+	void words( uint32_t address, const uint32_t* w, uint32_t n, bool skipblank = false ){
+		uint32_t i = 0;
+		while( i < n ){
+			uint32_t len = 8 - ( address + i ) % 8;
+			if( len > n - i ) len = n - i;
+			bool blank = true;
+			for( uint32_t j = 0; j < len; j++ ){
+				if( ( w[i + j] & 0x3fff ) != ERASED ) blank = false;
+			}
+			if( !blank || !skipblank ) record( address + i, w + i, len );
+			i += len;
+		}
+	}
+	void end(){
+		fprintf(m_fp, ":00000001FF\n");
+	}
+
+private:
+	void record( uint32_t address, const uint32_t* w, uint32_t len ){
+		uint32_t byteaddr = address * 2;
+		if( byteaddr >> 16 != m_upper ){
+			m_upper = byteaddr >> 16;
+			uint8_t sum = 2 + 0x04 + ( m_upper >> 8 ) + ( m_upper & 0xff );
+			fprintf(m_fp, ":02000004%04X%02X\n", m_upper, (uint8_t)-sum);
+		}
+		uint8_t sum = len * 2 + ( (byteaddr >> 8) & 0xff ) + ( byteaddr & 0xff );
+		fprintf(m_fp, ":%02X%04X00", len * 2, byteaddr & 0xffff);
+		for( uint32_t j = 0; j < len; j++ ){
+			uint8_t lo = w[j] & 0xff, hi = ( w[j] >> 8 ) & 0xff;
+			sum += lo + hi;
+			fprintf(m_fp, "%02X%02X", lo, hi);
+		}
+		fprintf(m_fp, "%02X\n", (uint8_t)-sum);
+	}
+
+	FILE* m_fp;
+	uint32_t m_upper;
+};
+
+#endif
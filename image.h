@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <vector>
+
+#ifndef __IMAGE_HEADER__
+#define __IMAGE_HEADER__
+
+#define ERASED   0x3fff	//value of an erased 14-bit flash word
+#define MAXWORDS 0x8000	//program memory address space in words
+#define USERID   0x8000	//4 user ID words
+#define CONFIG   0x8007	//5 configuration words
+
+/*
+ * Sparse program memory image.
+ *
+ * Only rows that have been written to are stored; each one is a full row
+ * of words initialised to the erased value, so a partially used row pads
+ * with 0x3fff rather than with NOPs. m_slot maps a row number to its
+ * position in m_data (or NOROW). Iterate rows in address order with
+ * first()/next(). User ID and configuration words are kept apart with a
+ * mask of which ones the image defines.
+ */
+class Image{
+public:
+	static const uint16_t NOROW = 0xffff;
+
+	Image( uint32_t rowsize = 32 ){
+		m_rowsize = rowsize;
+		m_slot.assign( MAXWORDS / rowsize, NOROW );
+		m_end = 0;
+		m_idmask = 0;
+		m_cfgmask = 0;
+	}
+	void clear(){
+		m_slot.assign( MAXWORDS / m_rowsize, NOROW );
+		m_data.clear();
+		m_end = 0;
+		m_idmask = 0;
+		m_cfgmask = 0;
+	}
+
+	/* Store a word at a program, user ID or config address. Returns false
+	 * for addresses the image cannot hold */
+	bool set( uint32_t address, uint32_t word ){
+		if( address >= USERID && address < USERID + 4 ){
+			m_userid[address - USERID] = word & 0x3fff;
+			m_idmask |= 1 << (address - USERID);
+			return true;
+		}
+		if( address >= CONFIG && address < CONFIG + 5 ){
+			m_config[address - CONFIG] = word & 0x3fff;
+			m_cfgmask |= 1 << (address - CONFIG);
+			return true;
+		}
+		if( address >= MAXWORDS ) return false;
+		uint32_t row = address / m_rowsize;
+		if( m_slot[row] == NOROW ){
+			m_slot[row] = m_data.size() / m_rowsize;
+			m_data.resize( m_data.size() + m_rowsize, ERASED );
+		}
+		m_data[ m_slot[row] * m_rowsize + address % m_rowsize ] = word & 0x3fff;
+		if( address + 1 > m_end ) m_end = address + 1;
+		return true;
+	}
+	/* Copy n consecutive words, e.g. an Instructions::program() array */
+	void load( const uint32_t* words, uint32_t n, uint32_t origin = 0 ){
+		for( uint32_t i = 0; i < n; i++ ) set( origin + i, words[i] );
+	}
+	uint32_t get( uint32_t address ) const{
+		if( address >= USERID && address < USERID + 4 ){
+			return ( m_idmask & (1 << (address - USERID)) ) ? m_userid[address - USERID] : ERASED;
+		}
+		if( address >= CONFIG && address < CONFIG + 5 ){
+			return ( m_cfgmask & (1 << (address - CONFIG)) ) ? m_config[address - CONFIG] : ERASED;
+		}
+		uint32_t row = address / m_rowsize;
+		if( row >= m_slot.size() || m_slot[row] == NOROW ) return ERASED;
+		return m_data[ m_slot[row] * m_rowsize + address % m_rowsize ];
+	}
+
+	/* Re-bucket into rows of another size, e.g. the part's erase row.
+	 * Every word of a present row stays present */
+	void regroup( uint32_t rowsize ){
+		if( rowsize == m_rowsize ) return;
+		Image img( rowsize );
+		for( uint32_t r = first(); r != NOROW; r = next( r ) ){
+			img.load( row( r ), m_rowsize, r * m_rowsize );
+		}
+		for( int i = 0; i < 4; i++ ){
+			if( m_idmask & (1 << i) ) img.set( USERID + i, m_userid[i] );
+		}
+		for( int i = 0; i < 5; i++ ){
+			if( m_cfgmask & (1 << i) ) img.set( CONFIG + i, m_config[i] );
+		}
+		*this = img;
+	}
+
+	/* Bit i set if user ID / config word i is defined */
+	uint32_t userids() const{ return m_idmask; }
+	uint32_t configs() const{ return m_cfgmask; }
+	uint32_t userid( int i ) const{ return m_userid[i]; }
+	uint32_t config( int i ) const{ return m_config[i]; }
+
+	uint32_t rowsize() const{ return m_rowsize; }
+	/* One past the highest address written */
+	uint32_t end() const{ return m_end; }
+	/* Number of rows holding data */
+	uint32_t rows() const{ return m_data.size() / m_rowsize; }
+	bool empty() const{ return m_data.empty(); }
+
+	bool present( uint32_t row ) const{
+		return row < m_slot.size() && m_slot[row] != NOROW;
+	}
+	/* Words of a present row */
+	uint32_t* row( uint32_t row ){
+		return &m_data[ m_slot[row] * m_rowsize ];
+	}
+	const uint32_t* row( uint32_t row ) const{
+		return &m_data[ m_slot[row] * m_rowsize ];
+	}
+	/* True if a row is absent or all erased, i.e. needs no programming
+	 * after an erase */
+	bool blank( uint32_t row ) const{
+		if( !present( row ) ) return true;
+		const uint32_t* w = this->row( row );
+		for( uint32_t i = 0; i < m_rowsize; i++ ){
+			if( w[i] != ERASED ) return false;
+		}
+		return true;
+	}
+
+	/* Present rows in address order: for( r = first(); r != NOROW; r = next(r) ) */
+	uint32_t first() const{
+		return next( (uint32_t)-1 );
+	}
+	uint32_t next( uint32_t row ) const{
+		uint32_t last = ( m_end + m_rowsize - 1 ) / m_rowsize;
+		for( uint32_t r = row + 1; r < last; r++ ){
+			if( m_slot[r] != NOROW ) return r;
+		}
+		return NOROW;
+	}
+
+private:
+	uint32_t m_rowsize;
+	uint32_t m_end;
+	std::vector<uint16_t> m_slot;
+	std::vector<uint32_t> m_data;
+	uint32_t m_userid[4];
+	uint32_t m_config[5];
+	uint32_t m_idmask;
+	uint32_t m_cfgmask;
+};
+const uint16_t Image::NOROW;
+
+#endif
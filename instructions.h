@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <array>
+
+#ifndef __INSTRUCTIONS_HEADER__
+#define __INSTRUCTIONS_HEADER__
+
+typedef struct reggi{
+	uint8_t addr;
+	uint8_t bank;
+	constexpr reggi(uint8_t a, uint8_t b):addr(a),bank(b){
+	}
+	constexpr reggi():addr(0),bank(0){
+	}
+}Register;
+
+namespace Instructions{
+
+	/* SPI Programming instructions */
+	const uint8_t READNVM       	= 0xfc;
+	const uint8_t READNVM_INCPC 	= 0xfe;
+	const uint8_t SETPC		= 0x80;
+	const uint8_t INCPC		= 0xf8;
+	const uint8_t LOADNVM		= 0x00;
+	const uint8_t LOADNVM_INCPC	= 0x02;
+	const uint8_t BULKERASE		= 0x18;
+	const uint8_t ROWERASE		= 0xf0;
+	const uint8_t BEGININTPROGRAM   = 0xe0;
+	const uint8_t BEGINEXTPROGRAM   = 0xc0;
+	const uint8_t ENDEXTPROGRAM     = 0x82;
+
+	constexpr Register STATUS(0x03, 0 );
+	constexpr Register INTCON(0x0b, 0 );
+	constexpr Register INTPPS(0x10, 0 );
+	constexpr Register PORTA( 0x0c, 0 );
+	constexpr Register PORTB( 0x0d, 0 );
+	constexpr Register PORTC( 0x0e, 0 );
+	constexpr Register PORTD( 0x0f, 0 );
+	constexpr Register PORTE( 0x10, 0 );
+	constexpr Register TRISA( 0x12, 0 );
+	constexpr Register TRISB( 0x13, 0 );
+	constexpr Register TRISC( 0x14, 0 );
+	constexpr Register TRISD( 0x15, 0 );
+	constexpr Register TRISE( 0x16, 0 );
+	constexpr Register LATA ( 0x18, 0 );
+	constexpr Register LATB ( 0x19, 0 );
+	constexpr Register LATC ( 0x1a, 0 );
+	constexpr Register LATD ( 0x1b, 0 );
+	constexpr Register LATE ( 0x1c, 0 );
+	constexpr Register SFR  ( 0x0c, 0 );
+	constexpr Register GRAM ( 0x20, 0 );
+	constexpr Register CRAM ( 0x70, 0 ); //COMMON Register RAM
+	constexpr Register PIR0 ( 0x0c, 0 );
+	constexpr Register PIR1 ( 0x0d, 0 );
+	constexpr Register PIR2 ( 0x0e, 0 );
+	constexpr Register PIE0 ( 0x16, 0 );
+	constexpr Register PIE1 ( 0x17, 0 );
+	constexpr Register PIE2 ( 0x18, 0 );
+
+	/* Operand range checks. badOperand() is deliberately not constexpr:
+	 * an out of range operand in a constant expression fails the build,
+	 * at run time it aborts instead of silently masking. */
+	inline uint32_t badOperand( int v, int lo, int hi ){
+		fprintf(stderr, "Operand %d outside %d..%d\n", v, lo, hi);
+		exit(EXIT_FAILURE);
+	}
+	constexpr uint32_t operand( int v, int lo, int hi, uint32_t mask ){
+		return ( v < lo || v > hi ) ? badOperand( v, lo, hi ) : ( (uint32_t)v & mask );
+	}
+
+	/* PIC Instruction Set */
+	/* Byte-Oriented Operations */
+	constexpr uint32_t ADDWF ( int d, int f ){ return ( 0x0700 | ( operand( d, 0, 1, 1 ) << 7 ) | operand( f, 0, 0x7f, 0x7f ) ); }
+	constexpr uint32_t ADDWFC( int d, int f ){ return ( 0x3d00 | ( operand( d, 0, 1, 1 ) << 7 ) | operand( f, 0, 0x7f, 0x7f ) ); }
+	constexpr uint32_t ANDWF ( int d, int f ){ return ( 0x0500 | ( operand( d, 0, 1, 1 ) << 7 ) | operand( f, 0, 0x7f, 0x7f ) ); }
+	constexpr uint32_t ASRF  ( int d, int f ){ return ( 0x3700 | ( operand( d, 0, 1, 1 ) << 7 ) | operand( f, 0, 0x7f, 0x7f ) ); }
+	constexpr uint32_t LSLF  ( int d, int f ){ return ( 0x3500 | ( operand( d, 0, 1, 1 ) << 7 ) | operand( f, 0, 0x7f, 0x7f ) ); }
+	constexpr uint32_t LSRF  ( int d, int f ){ return ( 0x3600 | ( operand( d, 0, 1, 1 ) << 7 ) | operand( f, 0, 0x7f, 0x7f ) ); }
+	constexpr uint32_t CLRF  (        int f ){ return ( 0x0180                                | operand( f, 0, 0x7f, 0x7f ) ); }
+	constexpr uint32_t CLRW  (                   ){ return ( 0x0100                             ); }
+	constexpr uint32_t COMF  ( int d, int f ){ return ( 0x0900 | ( operand( d, 0, 1, 1 ) << 7 ) | operand( f, 0, 0x7f, 0x7f ) ); }
+	constexpr uint32_t DECF  ( int d, int f ){ return ( 0x0300 | ( operand( d, 0, 1, 1 ) << 7 ) | operand( f, 0, 0x7f, 0x7f ) ); }
+	constexpr uint32_t INCF  ( int d, int f ){ return ( 0x0a00 | ( operand( d, 0, 1, 1 ) << 7 ) | operand( f, 0, 0x7f, 0x7f ) ); }
+	constexpr uint32_t IORWF ( int d, int f ){ return ( 0x0400 | ( operand( d, 0, 1, 1 ) << 7 ) | operand( f, 0, 0x7f, 0x7f ) ); }
+	constexpr uint32_t MOVF  ( int d, int f ){ return ( 0x0800 | ( operand( d, 0, 1, 1 ) << 7 ) | operand( f, 0, 0x7f, 0x7f ) ); }
+	constexpr uint32_t MOVWF (        int f ){ return ( 0x0080                                | operand( f, 0, 0x7f, 0x7f ) ); }
+	constexpr uint32_t RLF   ( int d, int f ){ return ( 0x0d00 | ( operand( d, 0, 1, 1 ) << 7 ) | operand( f, 0, 0x7f, 0x7f ) ); }
+	constexpr uint32_t RRF   ( int d, int f ){ return ( 0x0c00 | ( operand( d, 0, 1, 1 ) << 7 ) | operand( f, 0, 0x7f, 0x7f ) ); }
+	constexpr uint32_t SUBWF ( int d, int f ){ return ( 0x0200 | ( operand( d, 0, 1, 1 ) << 7 ) | operand( f, 0, 0x7f, 0x7f ) ); }
+	constexpr uint32_t SUBWFB( int d, int f ){ return ( 0x3b00 | ( operand( d, 0, 1, 1 ) << 7 ) | operand( f, 0, 0x7f, 0x7f ) ); }
+	constexpr uint32_t SWAPF ( int d, int f ){ return ( 0x0e00 | ( operand( d, 0, 1, 1 ) << 7 ) | operand( f, 0, 0x7f, 0x7f ) ); }
+	constexpr uint32_t XORWF ( int d, int f ){ return ( 0x0600 | ( operand( d, 0, 1, 1 ) << 7 ) | operand( f, 0, 0x7f, 0x7f ) ); }
+
+	/* Byte Oriented Skip Operations */
+	constexpr uint32_t DECFSZ( int d, int f ){ return ( 0x0b00 | ( operand( d, 0, 1, 1 ) << 7 ) | operand( f, 0, 0x7f, 0x7f ) ); }
+	constexpr uint32_t INCFSZ( int d, int f ){ return ( 0x0f00 | ( operand( d, 0, 1, 1 ) << 7 ) | operand( f, 0, 0x7f, 0x7f ) ); }
+
+	/* Bit Oriented File Register Operations */
+	constexpr uint32_t BCF   ( int d, int f ){ return ( 0x1000 | ( operand( d, 0, 7, 0x07 ) << 7 ) | operand( f, 0, 0x7f, 0x7f ) ); }
+	constexpr uint32_t BSF   ( int d, int f ){ return ( 0x1400 | ( operand( d, 0, 7, 0x07 ) << 7 ) | operand( f, 0, 0x7f, 0x7f ) ); }
+
+	/* Bit oriented skip operations */
+	constexpr uint32_t BTFSC ( int d, int f ){ return ( 0x1800 | ( operand( d, 0, 7, 0x07 ) << 7 ) | operand( f, 0, 0x7f, 0x7f ) ); }
+	//uint32_t BTFSS ( uint8_t d, uint8_t f ){ return ( 0x1800 | ( (d & 0x07) << 7 ) | ( f & 0x7f ) ); } //INCORRECT IN MANUAL
+	
+	/* Literal Operations */
+	constexpr uint32_t ADDLW( int k ){ return ( 0x3e00 | operand( k, -128, 0xff, 0xff ) ); }
+	constexpr uint32_t ANDLW( int k ){ return ( 0x3900 | operand( k, -128, 0xff, 0xff ) ); }
+	constexpr uint32_t IORLW( int k ){ return ( 0x3800 | operand( k, -128, 0xff, 0xff ) ); }
+	constexpr uint32_t MOVLB( int k ){ return ( 0x0140 | operand( k, 0, 0x3f, 0x3f ) ); } //INCORRECT IN MANUAL, but found soln on microchip.com/forms/m1131489.aspx
+	constexpr uint32_t MOVLP( int k ){ return ( 0x3180 | operand( k, 0, 0x7f, 0x7f ) ); }
+	constexpr uint32_t MOVLW( int k ){ return ( 0x3000 | operand( k, -128, 0xff, 0xff ) ); }
+	constexpr uint32_t SUBLW( int k ){ return ( 0x3c00 | operand( k, -128, 0xff, 0xff ) ); }
+	constexpr uint32_t XORLW( int k ){ return ( 0x3a00 | operand( k, -128, 0xff, 0xff ) ); }
+
+	constexpr uint32_t BRA   ( int k ){ return ( 0x3200 | operand( k, -256, 0xff, 0x1ff ) ); }
+	constexpr uint32_t BRW   (            ){ return ( 0x000b ); }
+	constexpr uint32_t CALL  ( int k ){ return ( 0x2000 | operand( k, 0, 0x7ff, 0x7ff ) ); }
+	constexpr uint32_t CALLW (            ){ return ( 0x000a ); } 
+	constexpr uint32_t GOTO  ( int k ){ return ( 0x2800 | operand( k, 0, 0x7ff, 0x7ff ) ); }
+	//uint32_t RETFIE( uint16_t k ){ return ( 0x2800 | ( k & 0x7ff ) ); } //SEEMS INCORRECT IN MANUAL
+	constexpr uint32_t RETFIE(){ return 0x0009; }
+	constexpr uint32_t RETLW ( int k ){ return ( 0x3400 | operand( k, -128, 0xff, 0xff ) ); }
+	constexpr uint32_t RETURN(            ){ return ( 0x0008 ); } 
+
+	/* Inherent Ops */
+	constexpr uint32_t CLRWDT(){ return 0x0064; } 
+	constexpr uint32_t NOP   (){ return 0x0000; } 
+	constexpr uint32_t RESET (){ return 0x0001; } 
+	constexpr uint32_t SLEEP (){ return 0x0063; } 
+
+	constexpr uint32_t SLEEP (int f){ return ( 0x0060 | operand( f, 0, 7, 0x07 ) ); }
+
+	/* C-compiler optimized */
+	constexpr uint32_t ADDFSR( int n, int k ){ return ( 0x3100 | ( operand( n, 0, 1, 1 ) << 6 ) | operand( k, -32, 31, 0x3f ) ); }
+
+	constexpr uint32_t MOVIWmm( int n, int m ){ return ( 0x0010 | ( operand( n, 0, 1, 1 ) << 2 ) | operand( m, 0, 3, 0x03 ) ); }
+	constexpr uint32_t MOVIW  ( int n, int k ){ return ( 0x3f00 | ( operand( n, 0, 1, 1 ) << 6 ) | operand( k, -32, 31, 0x3f ) ); }
+
+	constexpr uint32_t MOVWImm( int n, int m ){ return ( 0x0018 | ( operand( n, 0, 1, 1 ) << 2 ) | operand( m, 0, 3, 0x03 ) ); }
+	constexpr uint32_t MOVWI  ( int n, int k ){ return ( 0x3f80 | ( operand( n, 0, 1, 1 ) << 6 ) | operand( k, -32, 31, 0x3f ) ); }
+
+	/* A fixed program as a compile time constant:
+	 *   constexpr auto fw = Instructions::program( MOVLW(1), ... );
+	 * lives in .rodata and goes to Image::load() as is */
+	template<typename... W>
+	constexpr std::array<uint32_t, sizeof...(W)> program( W... words ){
+		return std::array<uint32_t, sizeof...(W)>{ { (uint32_t)words... } };
+	}
+
+};
+
+#define STOPBIT 1
+
+#define PAYLOADSZ 24 //PIC16F152xx Family Programming Spec Section 3.2
+
+#endif
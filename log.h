@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+
+#include "timing.h"
+#include "realtime.h"
+
+#ifndef __LOG_HEADER__
+#define __LOG_HEADER__
+
+#define LOG_SIZE   8192		//records in flight, power of two
+#define LOG_PERIOD (2 * MSEC)	//how often the writer wakes
+
+/*
+ * Progress records, formatted off the programming thread.
+ *
+ * A record is a timestamp, a level, an event and three numbers; which
+ * text or JSON fields those numbers become is the event's business (see
+ * s_event). push() claims a slot in a preallocated ring with one CAS and
+ * returns, never blocking and never calling into the kernel; a full ring
+ * drops the record and counts it. A writer thread wakes every LOG_PERIOD
+ * and formats what has arrived, as the old text lines or as JSON lines.
+ * The writer runs SCHED_OTHER. Records below the level set by start()
+ * are dropped before they are queued. Until start(), or after stop(),
+ * records are written on the spot. flush() waits for the writer before
+ * synchronous output that must come after them.
+ */
+class Log{
+public:
+	typedef enum{
+		WORD = 0, ROW, INFO, LEVELS
+	}Level;
+	typedef enum{
+		ROWWRITE = 0, ROWERASE, WORDCHECK, IDWORD, CFGWORD, EVENTS
+	}Event;
+	typedef struct record{
+		nsec_t   t;
+		uint8_t  level;
+		uint8_t  event;
+		uint32_t a, b, c;
+	}Record;
+
+	static void start( Level level, FILE* fp = stdout, bool json = false ){
+		stop();
+		s_level = level;
+		s_fp = fp;
+		s_json = json;
+		s_t0 = Timing::now();
+		for( size_t i = 0; i < LOG_SIZE; i++ ) s_ring[i].seq.store( i, std::memory_order_relaxed );
+		s_head.store( 0 );
+		s_tail = 0;
+		s_done.store( 0 );
+		s_running.store( true );
+		s_writer = std::thread( run );
+	}
+	/* Write out everything queued and go back to writing on the spot */
+	static void stop(){
+		if( !s_running.load() ) return;
+		s_running.store( false );
+		s_writer.join();
+		drain();
+		fflush( s_fp );
+		uint64_t lost = s_dropped.exchange( 0 );
+		if( lost ) fprintf(stderr, "Log: %" PRIu64 " records dropped\n", lost);
+	}
+	static void flush(){
+		if( !s_running.load() ) return;
+		uint64_t want = s_head.load();
+		while( s_done.load() < want ) usleep( LOG_PERIOD / 4 / USEC );
+		fflush( s_fp );
+	}
+
+	static inline void push( Level level, Event event, uint32_t a, uint32_t b = 0, uint32_t c = 0 ){
+		if( level < s_level ) return;
+		Record r = { Timing::now(), (uint8_t)level, (uint8_t)event, a, b, c };
+		if( !s_running.load( std::memory_order_relaxed ) ){
+			write( r );
+			return;
+		}
+		uint64_t pos = s_head.load( std::memory_order_relaxed );
+		Slot* s;
+		for( ;; ){
+			s = &s_ring[pos & (LOG_SIZE - 1)];
+			int64_t dif = (int64_t)s->seq.load( std::memory_order_acquire ) - (int64_t)pos;
+			if( dif == 0 ){
+				if( s_head.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) ) break;
+			}
+			else if( dif < 0 ){
+				s_dropped.fetch_add( 1, std::memory_order_relaxed );
+				return;
+			}
+			else pos = s_head.load( std::memory_order_relaxed );
+		}
+		s->r = r;
+		s->seq.store( pos + 1, std::memory_order_release );
+	}
+
+	/* The lines the programmer has always printed */
+	static inline void row( uint32_t row, uint32_t addr ){ push( ROW, ROWWRITE, row, addr ); }
+	static inline void erase( uint32_t row, uint32_t addr ){ push( ROW, ROWERASE, row, addr ); }
+	static inline void word( uint32_t i, uint32_t got, uint32_t want ){ push( WORD, WORDCHECK, i, got, want ); }
+	static inline void userid( uint32_t got, uint32_t want ){ push( ROW, IDWORD, got, want ); }
+	static inline void config( uint32_t got, uint32_t want ){ push( ROW, CFGWORD, got, want ); }
+
+private:
+	typedef struct slot{
+		std::atomic<uint64_t> seq;
+		Record r;
+	}Slot;
+	typedef struct format{
+		const char* name;
+		const char* text;	//printf format taking a, b, c
+		const char* field[3];	//JSON names of a, b, c, NULL if unused
+		unsigned hex;		//bit i set: field i is a flash word
+	}Format;
+
+	static void run(){
+		Realtime::background();
+		while( s_running.load() ){
+			usleep( LOG_PERIOD / USEC );	//not Timing::wait, that counts as an ICSP hold
+			drain();
+			fflush( s_fp );
+		}
+	}
+	static void drain(){
+		for( ;; ){
+			Slot& s = s_ring[s_tail & (LOG_SIZE - 1)];
+			if( s.seq.load( std::memory_order_acquire ) != s_tail + 1 ) return;
+			Record r = s.r;
+			s.seq.store( s_tail + LOG_SIZE, std::memory_order_release );
+			s_tail++;
+			write( r );
+			s_done.fetch_add( 1, std::memory_order_release );
+		}
+	}
+	static void write( const Record& r ){
+		const Format& f = s_event[r.event];
+		if( !s_json ){
+			fprintf(s_fp, f.text, r.a, r.b, r.c);
+			fputc( '\n', s_fp );
+			return;
+		}
+		static const char* level[] = { "word", "row", "info" };
+		fprintf(s_fp, "{\"t_us\":%.3f,\"level\":\"%s\",\"event\":\"%s\"",
+				( r.t - s_t0 ) / (double)USEC, level[r.level], f.name);
+		uint32_t v[3] = { r.a, r.b, r.c };
+		for( int i = 0; i < 3 && f.field[i]; i++ ){
+			if( f.hex & (1 << i) ) fprintf(s_fp, ",\"%s\":\"%04x\"", f.field[i], v[i]);
+			else fprintf(s_fp, ",\"%s\":%u", f.field[i], v[i]);
+		}
+		fputs( "}\n", s_fp );
+	}
+
+	static const Format s_event[EVENTS];
+
+	static Slot s_ring[LOG_SIZE];
+	static std::atomic<uint64_t> s_head;
+	static uint64_t s_tail;
+	static std::atomic<uint64_t> s_done;
+	static std::atomic<uint64_t> s_dropped;
+	static std::atomic<bool> s_running;
+	static std::thread s_writer;
+	static Level s_level;
+	static FILE* s_fp;
+	static bool s_json;
+	static nsec_t s_t0;
+};
+const Log::Format Log::s_event[EVENTS] = {
+	{ "row",    "Row: %u [addr: %u]",        { "row", "addr", NULL }, 0 },
+	{ "erase",  "Row: %u [addr: %u] erase",  { "row", "addr", NULL }, 0 },
+	{ "word",   "%u: Ret: %04x - Dat: %04x", { "i", "got", "want" }, 6 },
+	{ "userid", "Ret: %04x - uid: %04x",     { "got", "want", NULL }, 3 },
+	{ "config", "ret: %04x - conf: %04x",    { "got", "want", NULL }, 3 },
+};
+Log::Slot Log::s_ring[LOG_SIZE];
+std::atomic<uint64_t> Log::s_head( 0 );
+uint64_t Log::s_tail = 0;
+std::atomic<uint64_t> Log::s_done( 0 );
+std::atomic<uint64_t> Log::s_dropped( 0 );
+std::atomic<bool> Log::s_running( false );
+std::thread Log::s_writer;
+Log::Level Log::s_level = Log::WORD;
+FILE* Log::s_fp = stdout;
+bool Log::s_json = false;
+nsec_t Log::s_t0 = 0;
+
+#endif
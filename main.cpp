@@ -6,523 +6,506 @@
 #include <sys/mman.h>
 #include <vector>
 #include <inttypes.h>
+#include <sys/stat.h>
+#include <string>
+#include <unordered_map>
 
 #include "pic.h"
+#include "timing.h"
+#include "session.h"
+#include "instructions.h"
+#include "gang.h"
+#include "verify.h"
+#include "image.h"
+#include "hex.h"
+#include "assembler.h"
+#include "realtime.h"
+#include "transport.h"
+#include "bitbang.h"
+#include "spi.h"
+#include "target.h"
+#include "bench.h"
+#include "trace.h"
+#include "capture.h"
+#include "dwell.h"
+#include "device.h"
+#include "daemon.h"
+#include "fingerprint.h"
+#include "plan.h"
+#include "pipeline.h"
+#include "log.h"
+#include "sim.h"
+#include "programmer.h"
 
 
-#define TENTS 10
-#define TENTH 250
-#define TCKL  10
-#define TCKH  10
-#define TDS   10
-#define TDH   10
-#define TDLY  10
-#define TERAB 13000
-#define TERAR 2800
-#define TPEXT 2100
-#define TPINT 2800
-#define TEXIT 10
-#define TDIS 300
-
-typedef struct reggi{
-	uint8_t addr;
-	uint8_t bank;
-	reggi(uint8_t a, uint8_t b):addr(a),bank(b){
-	}
-	reggi(){
-	}
-}Register;
-
-namespace Instructions{
-
-	/* SPI Programming instructions */
-	const uint8_t READNVM       	= 0xfc;
-	const uint8_t READNVM_INCPC 	= 0xfe;
-	const uint8_t SETPC		= 0x80;
-	const uint8_t INCPC		= 0xf8;
-	const uint8_t LOADNVM		= 0x00;
-	const uint8_t LOADNVM_INCPC	= 0x02;
-	const uint8_t BULKERASE		= 0x18;
-	const uint8_t ROWERASE		= 0xf0;
-	const uint8_t BEGININTPROGRAM   = 0xe0;
-	const uint8_t BEGINEXTPROGRAM   = 0xc0;
-	const uint8_t ENDEXTPROGRAM     = 0x82;
-
-	const Register STATUS(0x03, 0 );
-	const Register INTCON(0x0b, 0 );
-	const Register INTPPS(0x10, 0 );
-	const Register PORTA( 0x0c, 0 );
-	const Register PORTB( 0x0d, 0 );
-	const Register PORTC( 0x0e, 0 );
-	const Register PORTD( 0x0f, 0 );
-	const Register PORTE( 0x10, 0 );
-	const Register TRISA( 0x12, 0 );
-	const Register TRISB( 0x13, 0 );
-	const Register TRISC( 0x14, 0 );
-	const Register TRISD( 0x15, 0 );
-	const Register TRISE( 0x16, 0 );
-	const Register LATA ( 0x18, 0 );
-	const Register LATB ( 0x19, 0 );
-	const Register LATC ( 0x1a, 0 );
-	const Register LATD ( 0x1b, 0 );
-	const Register LATE ( 0x1c, 0 );
-	const Register SFR  ( 0x0c, 0 );
-	const Register GRAM ( 0x20, 0 );
-	const Register CRAM ( 0x70, 0 ); //COMMON Register RAM
-	const Register PIR0 ( 0x0c, 0 );
-	const Register PIR1 ( 0x0d, 0 );
-	const Register PIR2 ( 0x0e, 0 );
-	const Register PIE0 ( 0x16, 0 );
-	const Register PIE1 ( 0x17, 0 );
-	const Register PIE2 ( 0x18, 0 );
-
-	/* PIC Instruction Set */
-	/* Byte-Oriented Operations */
-	uint32_t ADDWF ( bool d, uint8_t f ){ return ( 0x0700 | ( d << 7 ) | ( f & 0x7f ) ); }
-	uint32_t ADDWFC( bool d, uint8_t f ){ return ( 0x3d00 | ( d << 7 ) | ( f & 0x7f ) ); }
-	uint32_t ANDWF ( bool d, uint8_t f ){ return ( 0x0500 | ( d << 7 ) | ( f & 0x7f ) ); }
-	uint32_t ASRF  ( bool d, uint8_t f ){ return ( 0x3700 | ( d << 7 ) | ( f & 0x7f ) ); }
-	uint32_t LSLF  ( bool d, uint8_t f ){ return ( 0x3500 | ( d << 7 ) | ( f & 0x7f ) ); }
-	uint32_t LSRF  ( bool d, uint8_t f ){ return ( 0x3600 | ( d << 7 ) | ( f & 0x7f ) ); }
-	uint32_t CLRF  (         uint8_t f ){ return ( 0x0180              | ( f & 0x7f ) ); }
-	uint32_t CLRW  (                   ){ return ( 0x0100                             ); }
-	uint32_t COMF  ( bool d, uint8_t f ){ return ( 0x0900 | ( d << 7 ) | ( f & 0x7f ) ); }
-	uint32_t DECF  ( bool d, uint8_t f ){ return ( 0x0300 | ( d << 7 ) | ( f & 0x7f ) ); }
-	uint32_t INCF  ( bool d, uint8_t f ){ return ( 0x0a00 | ( d << 7 ) | ( f & 0x7f ) ); }
-	uint32_t IORWF ( bool d, uint8_t f ){ return ( 0x0400 | ( d << 7 ) | ( f & 0x7f ) ); }
-	uint32_t MOVF  ( bool d, uint8_t f ){ return ( 0x0800 | ( d << 7 ) | ( f & 0x7f ) ); }
-	uint32_t MOVWF (         uint8_t f ){ return ( 0x0080              | ( f & 0x7f ) ); }
-	uint32_t RLF   ( bool d, uint8_t f ){ return ( 0x0d00 | ( d << 7 ) | ( f & 0x7f ) ); }
-	uint32_t RRF   ( bool d, uint8_t f ){ return ( 0x0c00 | ( d << 7 ) | ( f & 0x7f ) ); }
-	uint32_t SUBWF ( bool d, uint8_t f ){ return ( 0x0200 | ( d << 7 ) | ( f & 0x7f ) ); }
-	uint32_t SUBWFB( bool d, uint8_t f ){ return ( 0x3b00 | ( d << 7 ) | ( f & 0x7f ) ); }
-	uint32_t SWAPF ( bool d, uint8_t f ){ return ( 0x0e00 | ( d << 7 ) | ( f & 0x7f ) ); }
-	uint32_t XORWF ( bool d, uint8_t f ){ return ( 0x0600 | ( d << 7 ) | ( f & 0x7f ) ); }
-
-	/* Byte Oriented Skip Operations */
-	uint32_t DECFSZ( bool d, uint8_t f ){ return ( 0x0b00 | ( d << 7 ) | ( f & 0x7f ) ); }
-	uint32_t INCFSZ( bool d, uint8_t f ){ return ( 0x0f00 | ( d << 7 ) | ( f & 0x7f ) ); }
-
-	/* Bit Oriented File Register Operations */
-	uint32_t BCF   ( uint8_t d, uint8_t f ){ return ( 0x1000 | ( (d & 0x07) << 7 ) | ( f & 0x7f ) ); }
-	uint32_t BSF   ( uint8_t d, uint8_t f ){ return ( 0x1400 | ( (d & 0x07) << 7 ) | ( f & 0x7f ) ); }
-
-	/* Bit oriented skip operations */
-	uint32_t BTFSC ( uint8_t d, uint8_t f ){ return ( 0x1800 | ( (d & 0x07) << 7 ) | ( f & 0x7f ) ); }
-	//uint32_t BTFSS ( uint8_t d, uint8_t f ){ return ( 0x1800 | ( (d & 0x07) << 7 ) | ( f & 0x7f ) ); } //INCORRECT IN MANUAL
-	
-	/* Literal Operations */
-	uint32_t ADDLW( uint8_t k ){ return ( 0x3e00 | ( k & 0xff ) ); }
-	uint32_t ANDLW( uint8_t k ){ return ( 0x3900 | ( k & 0xff ) ); }
-	uint32_t IORLW( uint8_t k ){ return ( 0x3800 | ( k & 0xff ) ); }
-	uint32_t MOVLB( uint8_t k ){ return ( 0x0140 | ( k & 0x3f ) ); } //INCORRECT IN MANUAL, but found soln on microchip.com/forms/m1131489.aspx
-	uint32_t MOVLP( uint8_t k ){ return ( 0x3180 | ( k & 0x7f ) ); }
-	uint32_t MOVLW( uint8_t k ){ return ( 0x3000 | ( k & 0xff ) ); }
-	uint32_t SUBLW( uint8_t k ){ return ( 0x3c00 | ( k & 0xff ) ); }
-	uint32_t XORLW( uint8_t k ){ return ( 0x3a00 | ( k & 0xff ) ); }
-
-	uint32_t BRA   ( uint16_t k ){ return ( 0x3200 | ( k & 0x1ff ) ); }
-	uint32_t BRW   (            ){ return ( 0x000b ); }
-	uint32_t CALL  ( uint16_t k ){ return ( 0x2000 | ( k & 0x7ff ) ); }
-	uint32_t CALLW (            ){ return ( 0x000a ); } 
-	uint32_t GOTO  ( uint16_t k ){ return ( 0x2800 | ( k & 0x7ff ) ); }
-	//uint32_t RETFIE( uint16_t k ){ return ( 0x2800 | ( k & 0x7ff ) ); } //SEEMS INCORRECT IN MANUAL
-	uint32_t RETFIE(){ return 0x0009; }
-	uint32_t RETLW ( uint8_t k ){ return ( 0x3400 | ( k & 0xff ) ); }
-	uint32_t RETURN(            ){ return ( 0x0008 ); } 
-
-	/* Inherent Ops */
-	uint32_t CLRWDT(){ return 0x0064; } 
-	uint32_t NOP   (){ return 0x0000; } 
-	uint32_t RESET (){ return 0x0001; } 
-	uint32_t SLEEP (){ return 0x0063; } 
-
-	uint32_t SLEEP (uint8_t f){ return ( 0x0060 | ( f & 0x07 ) ); }
-
-	/* C-compiler optimized */
-	uint32_t ADDFSR( bool n, uint8_t k ){ return ( 0x3100 | ( n << 6 ) | ( k & 0x3f ) ); }
-
-	uint32_t MOVIWmm( bool n, uint8_t m ){ return ( 0x0010 | ( n << 2 ) | ( m & 0x03 ) ); }
-	uint32_t MOVIW  ( bool n, uint8_t k ){ return ( 0x3f00 | ( n << 6 ) | ( k & 0x3f ) ); }
-
-	uint32_t MOVWImm( bool n, uint8_t m ){ return ( 0x0018 | ( n << 2 ) | ( m & 0x03 ) ); }
-	uint32_t MOVWI  ( bool n, uint8_t k ){ return ( 0x3f80 | ( n << 6 ) | ( k & 0x3f ) ); }
-
-};
-
-#define STOPBIT 1
-
-#define GPIO_MCLR   9 
-#define GPIO_CLOCK 11 
-#define GPIO_DATA  10 
-#define GPIO_POWER 22
-
-#define PAYLOADSZ 24 //PIC16F152xx Family Programming Spec Section 3.2
-
-class Programmer{
-public:
-	Programmer( uint8_t mclr = GPIO_MCLR, uint8_t clock = GPIO_CLOCK, uint8_t data = GPIO_DATA, uint8_t power = GPIO_POWER ){
-		m_mclr   = Pin(mclr);
-		m_clock  = Pin(clock);
-		m_data   = Pin(data);
-		m_pwr    = Pin(power);
-
-	}
-	uint32_t addCMD( uint32_t cmd, const char* func = NULL, bool resolve = false ){
-		if( func != NULL ){
-			if( resolve ){
-				Functions f(mem.size(), func, true );
-				m_func.push_back( f );
-			}
-			else{
-				Functions f(mem.size(), func, false );
-				m_func.push_back( f ) ;
-			}
-		}
-		mem.push_back(cmd);
-		return mem.size() - 1;
+using namespace Instructions;
+
+/* Interrupt test firmware, assembled at compile time (-f) */
+constexpr auto fixed = program(
+	NOP(),
+	BRA(5),
+	NOP(),
+	NOP(),
+	MOVLP(0),
+	CALL(0x1a),
+	RETFIE(),
+	MOVLB(0),
+	MOVLW(0x01),
+	MOVWF(TRISB.addr),
+	MOVLW(0x00),
+	MOVWF(TRISC.addr),
+	MOVWF(LATC.addr),
+	MOVLB(14),
+	MOVLW(0),
+	MOVWF(PIR0.addr),
+	MOVLW(0x01),
+	MOVWF(PIE0.addr),
+	MOVLB(0),
+	BSF(7, INTCON.addr),
+	CLRWDT(),
+	MOVLB(14),
+	MOVF(0,PIR0.addr),
+	MOVLB(0),
+	MOVWF(LATC.addr),
+	BRA(-6),
+	MOVLB(0),
+	MOVLW(0xce),
+	MOVWF(PORTC.addr),
+	RETURN()
+);
+
+static void reportJitter(){
+	Timing::printJitter( stdout );
+}
+
+static Trace* s_trace = NULL;
+static const char* s_tracefile = NULL;
+/* Runs on every exit, including the exit(EXIT_FAILURE) paths */
+static void dumpTrace(){
+	s_trace->close();
+	s_trace->chrome( s_tracefile );
+}
 
+/* Lay the image out in the part's erase rows; false if it doesn't fit */
+static bool fit( Programmer& pic, Image& img ){
+	const Device& d = pic.device();
+	img.regroup( d.rowsize() );
+	if( img.end() > d.words() ){
+		fprintf(stderr, "Image ends at %04x, %s has %u words\n", img.end(), d.name(), d.words());
+		return false;
 	}
-	uint32_t resolve( uint32_t cmd, const char* name ){
-		for( unsigned int i = 0; i < m_func.size(); i++){
-			if( strcmp( name, m_func[i].name ) == 0 && m_func[i].call == false ){
-				if( (cmd & 0x3800) == 0x2000 ){ //CALL
-					return 0x2000 | ( m_func[i].addr & 0x7f );
-				}
-				else{
-					fprintf(stderr, "UNIMPLEMENTED\n");
-					exit(EXIT_FAILURE);
-				}
-			}
-		}
-		fprintf(stderr, "UNEXPECTED END OF FUNCTION\n");
-		return 0x0000;
-	}
-	void uploadMain(){
-		uint32_t software_size = mem.size();
-		uint32_t minimum_size = software_size + 32 - (software_size % 32);
-		uint32_t total_rows = minimum_size / 32;
-
-		uint32_t *temp_mem = new uint32_t[minimum_size];
-		for( unsigned int i = 0; i < minimum_size; i++ ){
-			if( i < software_size ){
-				for( unsigned int j = 0; j < m_func.size(); j++){
-					if( i == m_func[j].addr ){
-						if( m_func[j].call == true ){
-							mem[i] = resolve(
-									mem[i],
-									m_func[j].name
-								);
-						}
-					}
-				}
-				temp_mem[i] = mem[i];
-			}
-			else temp_mem[i] = 0x0000;
-		}
-		for(unsigned int i = 0; i < total_rows; i++ ){
-			fprintf(stdout, "Row: %d [addr: %d]\n", i, 32*i);
-			if( !writeRow( 32*i, &temp_mem[32*i], 32 ) ){
-				fprintf(stderr, "Failed to write to memory\n");
-			}
-		}
-		delete [] temp_mem;
+	return true;
+}
 
+/* Program a started part the cheapest way the planner finds. The user
+ * IDs and config are read first; with incremental the image rows are too,
+ * which lets rows be erased one by one and rows outside the image stay as
+ * they are. Leaves the part powered and running. True if verify and the
+ * ID/config readback pass */
+static bool flash( Programmer& pic, const Image& image, const uint32_t* userid, const uint32_t* config,
+		Verify& verify, bool incremental ){
+	uint32_t curid[4], curcfg[5];
+	pic.readNVM( USERID, curid, 4 );
+	pic.readNVM( CONFIG, curcfg, 5 );
+	Image readback;
+	if( incremental ) pic.readRows( image, readback );
+	Planner planner( pic.device(), pic.dwell() );
+	Planner::Plan plan = planner.plan( image, userid, config, curid, curcfg, incremental ? &readback : NULL );
+	Planner::print( stdout, plan );
+
+	uint32_t n = image.rowsize();
+	if( plan.strategy == Planner::ROWS ){
+		for( size_t k = 0; k < plan.erase.size(); k++ ){
+			Log::erase( plan.erase[k], n*plan.erase[k] );
+			pic.setPC( n*plan.erase[k] );
+			pic.rowErase();
+		}
 	}
-	~Programmer(){
-		if( m_open ){
-			vppFirstExit();
+	else{
+		//according to table 3-2: from 0x8000 this erases all memory, from program memory only that
+		pic.setPC( plan.strategy == Planner::ALL ? 0x8000 : 0 );
+		pic.bulkErase();
+	}
+	//Write Program Memory
+	for( size_t k = 0; k < plan.write.size(); k++ ){
+		uint32_t r = plan.write[k];
+		Log::row( r, n*r );
+		if( !pic.loadRow( n*r, image.row( r ), n ) ){
+			fprintf(stderr, "Failed to write to memory\n");
 		}
 	}
-	void start(){
-		fprintf(stdout, "Starting up piC Programmer\n");
-		vppFirstEntry();
-		enterLVP();
-		fprintf(stdout, "Device %04x rev. %04x found.\n", getDeviceID(), getRevisionID() );
-		getDCI();
-		printDCI(stdout);
-		m_open = true;
-	}
-	void enterLVP(){
-
-		usleep(TENTS);
-		m_mclr.setVoltage(Pin::VLOW);
-		usleep(TENTH);
-
-		uint32_t bits = 0x4d434850;
-		write( bits, 32 );
-		usleep(TENTH);
-	}
-
-	uint32_t readNVM(){
-		write( Instructions::READNVM );
-		usleep(TDLY);
-		uint32_t ret = read( PAYLOADSZ );
-		usleep(TDLY);
-		return ret;
-	}
-
-	int readNVM( uint32_t address, uint32_t* data, size_t len ){
-		setPC( address );
-		for( unsigned int i = 0; i < len; i++ ){
-			write( Instructions::READNVM_INCPC );
-			usleep( TDLY );
-			data[i] = read(PAYLOADSZ);
-			usleep( TDLY );
+	pic.verify( image, verify );
+	Log::flush();
+	verify.report( stdout );
+
+	bool ok = verify.passed();
+	if( plan.iderase ){
+		pic.setPC(0x8000);
+		pic.rowErase();
+	}
+	//Write and verify User IDs
+	if( plan.idmask ) pic.setPC(0x8000);
+	for( int i = 0; i < 4 && plan.idmask >> i; i++ ){
+		if( plan.idmask & (1 << i) ){
+			pic.writeNVM( userid[i] );
+			pic.beginIntProgramming();
+			uint32_t ret = pic.readNVM();
+			if( ret != userid[i] ){
+				fprintf(stderr, "Failed to write userID\n");
+				ok = false;
+			}
+			Log::userid( ret, userid[i] );
 		}
-		return len;
+		pic.incPC();
 	}
 
-	int writeNVM( uint32_t data ){
-		write( Instructions::LOADNVM );
-		usleep( TDLY );
-		write( data << STOPBIT, PAYLOADSZ );
-		usleep( TDLY );
-		return 1;
-	}
 
-	int writeNVM( uint32_t address, uint32_t* data, size_t len ){
-		setPC( address );
-		for( unsigned int i = 0; i < len; i++ ){
-			write( Instructions::LOADNVM_INCPC );
-			usleep( TDLY );
-			write( data[i] << STOPBIT, PAYLOADSZ );
-			usleep( TDLY );
+	//Write and verify configuration words
+	if( plan.cfgmask ) pic.setPC(0x8007);
+	for( int i = 0; i < 5 && plan.cfgmask >> i; i++ ){
+		if( plan.cfgmask & (1 << i) ){
+			pic.writeNVM( config[i] );
+			pic.beginIntProgramming();
+			uint32_t ret = pic.readNVM();
+			if( (ret & config[i]) != config[i] ){
+				fprintf(stderr, "Failed to write configuration\n");
+				ok = false;
+			}
+			Log::config( ret, config[i] );
 		}
-		return len;
+		pic.incPC();
 	}
 
-	void setPC(uint32_t address){
-		// OPCODE
-		write( Instructions::SETPC );
-		usleep( TDLY );
-		/* Shift left because LSB is at bit 0 */
-		write( address << STOPBIT, PAYLOADSZ );
-		usleep( TDLY );
-	}
-	void incPC(){
-		write( Instructions::INCPC );
-		usleep( TDLY );
-	}
+	//STOP is automatically done in the constructor
+	pic.stop();
+	Log::flush();
 
-	void bulkErase(){
-		write( Instructions::BULKERASE );
-		usleep(TERAB);
-	}
+	Timing::wait(10 * MSEC);
+	pic.powerOn();
+	return ok;
+}
 
-	void rowErase(){
-		write( Instructions::ROWERASE );
-		usleep( TERAR );
-	}
+/* True if the user IDs and config already carry this image's stamp and
+ * n rows sampled across it read back unchanged */
+static bool current( Programmer& pic, const Image& image, const uint32_t* userid, const uint32_t* config,
+		uint32_t n ){
+	if( !pic.configMatches( userid, config ) ) return false;
+	Image sample = Fingerprint::sample( image, n );
+	Verify verify( Verify::FULL );
+	if( !pic.verify( sample, verify ) ){
+		fprintf(stdout, "Fingerprint matches but %zu sampled ranges differ\n", verify.mismatches().size());
+		return false;
+	}
+	return true;
+}
 
-	void beginIntProgramming(){
-		write( Instructions::BEGININTPROGRAM );
-		usleep( TPINT );
+/* User IDs and config words the image defines replace the defaults */
+static void idsFrom( const Image& img, uint32_t* userid, uint32_t* config ){
+	for( int i = 0; i < 4; i++ ){
+		if( img.userids() & (1 << i) ) userid[i] = img.userid(i);
 	}
-
-	void beginExtProgramming(){
-		write( Instructions::BEGINEXTPROGRAM);
-		usleep( TPEXT );
+	for( int i = 0; i < 5; i++ ){
+		if( img.configs() & (1 << i) ) config[i] = img.config(i);
 	}
+}
 
-	void endExtProgramming(){
-		write( Instructions::ENDEXTPROGRAM );
-		usleep( TDIS );
-	}
+/* Service mode images: parsed once, parsed again only if the file changes */
+typedef struct resident{
+	Image image;
+	time_t mtime;
+	uint32_t userid[4];	//the defaults, then the image's own, then the stamp with -u
+	uint32_t config[5];
+}Resident;
+
+/* userid/config are the defaults a hex file's IDs and config replace; the
+ * stamp is taken per image when it is parsed if stamp is set */
+static Resident* residentImage( std::unordered_map<std::string, Resident>& cache, const std::string& name,
+		const uint32_t* userid, const uint32_t* config, bool stamp, const char*& error ){
+	std::unordered_map<std::string, Resident>::iterator it = cache.find( name );
+	if( it != cache.end() && it->second.mtime == 0 ) return &it->second; //built in
+	struct stat st;
+	if( stat( name.c_str(), &st ) < 0 ){
+		error = "no such image";
+		return NULL;
+	}
+	if( it != cache.end() && it->second.mtime == st.st_mtime ) return &it->second;
+	Resident& r = cache[name];
+	r.image = Image();
+	if( !Hex::load( name.c_str(), r.image ) ){
+		cache.erase( name );
+		error = "cannot parse image";
+		return NULL;
+	}
+	r.mtime = st.st_mtime;
+	memcpy( r.userid, userid, sizeof(r.userid) );
+	memcpy( r.config, config, sizeof(r.config) );
+	idsFrom( r.image, r.userid, r.config );
+	if( stamp ) Fingerprint::stamp( r.image, r.config, r.userid );
+	return &r;
+}
 
-	void setConfig( uint32_t *words ){
-		writeNVM( 0x8000, words, 4 );
-		beginIntProgramming();
+static std::string quote( const std::string& s ){
+	std::string q = "\"";
+	for( size_t i = 0; i < s.size(); i++ ){
+		if( s[i] == '"' || s[i] == '\\' ) q += '\\';
+		if( (unsigned char)s[i] >= 0x20 ) q += s[i];
 	}
+	return q + "\"";
+}
 
-	/********* ROUND 2 *********/
-	bool writeRow( uint32_t address, uint32_t *data, size_t sz ){
-		if( sz != 32 ){	
-			fprintf(stderr, "Mismatch in sz\n");
-			return false;
+/*
+ * Service mode: run jobs from the socket until SIGINT or SIGTERM, one
+ * JSON line back per job. The GPIO mapping, the programmer and every image stay resident.
+ *
+ *   program <image> [full|crc|none] [incremental]
+ *   verify <image>
+ *   read <out.hex>
+ *   load <image>
+ *   status
+ *
+ * <image> is an Intel HEX path or "builtin" for the image main() loaded,
+ * with its user IDs and config. userid/config are the defaults for hex
+ * files. With spot >= 0 each image is fingerprinted as -u does and a
+ * program job leaves a part that already carries it alone.
+ */
+static void serve( Programmer& pic, Daemon& d, const Resident& builtin,
+		const uint32_t* userid, const uint32_t* config, int spot ){
+	std::unordered_map<std::string, Resident> cache;
+	cache["builtin"] = builtin;
+	cache["builtin"].mtime = 0;
+	Daemon::Job job;
+	while( d.next( job ) ){
+		std::vector<std::string> arg;
+		char line[DAEMON_LINE + 1];
+		snprintf( line, sizeof(line), "%s", job.line.c_str() );
+		for( char* tok = strtok( line, " \t" ); tok; tok = strtok( NULL, " \t" ) ) arg.push_back( tok );
+
+		char head[64];
+		snprintf( head, sizeof(head), "{\"job\":%u,\"cmd\":", job.id );
+		std::string result = head + quote( arg.empty() ? "" : arg[0] );
+		const char* error = NULL;
+		char buf[256];
+		nsec_t t = Timing::now();
+		fprintf(stdout, "Job %u: %s\n", job.id, job.line.c_str());
+
+		if( arg.empty() ) error = "empty job";
+		else if( arg[0] == "status" ){
+			snprintf( buf, sizeof(buf), ",\"images\":%zu,\"queued\":%zu", cache.size(), d.queued() );
+			result += buf;
 		}
-		setPC( address );
-		for( unsigned int i = 0; i < 32; i++ ){
-			write( Instructions::LOADNVM_INCPC );
-			usleep( TDLY );
-			write( data[i] << STOPBIT, PAYLOADSZ );
-			usleep( TDLY );
+		else if( arg[0] != "load" && arg[0] != "program" && arg[0] != "verify" && arg[0] != "read" ){
+			error = "unknown job";
 		}
-		setPC( address );
-		beginIntProgramming();
-		for( unsigned int i = 0; i < 32; i++ ){
-			write( Instructions::READNVM_INCPC );
-			usleep( TDLY );
-			uint32_t ret = read(PAYLOADSZ);
-			fprintf(stdout, "%d: Ret: %04x - Dat: %04x\n", i, ret, data[i] );
-			if( ret != data[i] ) return false;
-			usleep( TDLY );
+		else if( arg.size() < 2 ) error = "missing argument";
+		else if( arg[0] == "load" ){
+			Resident* r = residentImage( cache, arg[1], userid, config, spot >= 0, error );
+			if( r ){
+				snprintf( buf, sizeof(buf), ",\"rows\":%u", r->image.rows() );
+				result += buf;
+			}
 		}
-		return true;
+		else if( arg[0] == "program" || arg[0] == "verify" ){
+			Resident* r = residentImage( cache, arg[1], userid, config, spot >= 0, error );
+			Image* img = r ? &r->image : NULL;
+			Verify::Mode mode = Verify::FULL;
+			bool incremental = false;
+			for( size_t i = 2; i < arg.size() && !error; i++ ){
+				if( arg[i] == "incremental" ) incremental = true;
+				else if( !Verify::parse( arg[i].c_str(), mode ) ) error = "unknown option";
+			}
+			if( img && !error ){
+				pic.start();
+				if( !fit( pic, *img ) ){
+					pic.stop();
+					error = "image too large";
+				}
+			}
+			if( img && !error ){
+				Verify verify( mode );
+				bool ok, skipped = false;
+				if( arg[0] == "program" && spot >= 0 && current( pic, *img, r->userid, r->config, spot ) ){
+					fprintf(stdout, "Part already holds this image, nothing to program\n");
+					pic.stop();
+					Timing::wait(10 * MSEC);
+					pic.powerOn();
+					ok = skipped = true;
+				}
+				else if( arg[0] == "program" ) ok = flash( pic, *img, r->userid, r->config, verify, incremental );
+				else{
+					ok = pic.verify( *img, verify );
+					verify.report( stdout );
+					pic.stop();
+				}
+				snprintf( buf, sizeof(buf), ",\"device\":\"%04x\",\"rev\":\"%04x\",\"rows\":%u,"
+						"\"passed\":%s,\"ranges\":%zu",
+						pic.deviceID(), pic.revisionID(), img->rows(),
+						ok ? "true" : "false", verify.mismatches().size() );
+				result += buf;
+				if( skipped ) result += ",\"current\":true";
+				if( !ok ) error = "verify failed";
+			}
+		}
+		else if( arg[0] == "read" ){
+			FILE* fp = fopen( arg[1].c_str(), "w" );
+			if( fp == NULL ) error = "cannot write";
+			else{
+				pic.start();
+				HexWriter hex( fp );
+				uint32_t n = pic.readout( hex );
+				fclose( fp );
+				pic.stop();
+				snprintf( buf, sizeof(buf), ",\"device\":\"%04x\",\"words\":%u", pic.deviceID(), n );
+				result += buf;
+			}
+		}
+
+		t = Timing::now() - t;
+		snprintf( buf, sizeof(buf), ",\"ok\":%s,\"ms\":%" PRIu64, error ? "false" : "true", t / MSEC );
+		result += buf;
+		if( error ) result += ",\"error\":" + quote( error );
+		d.reply( job, result + "}" );
 	}
+}
+
+/* Time each primitive and a full upload of img. Destroys program memory,
+ * leaves user IDs and config alone */
+static void benchmark( Programmer& pic, Bench& b, Image& img ){
+	uint32_t row[DEVICE_MAXROW];
+	for( int i = 0; i < DEVICE_MAXROW; i++ ) row[i] = ( 0x1234 + 0x111 * i ) & 0x3fff;
 
-	uint16_t getDeviceID(){
-		setPC( 0x8006 );
-		return (uint16_t)readNVM();
+	pic.start();
+	if( !fit( pic, img ) ) exit(EXIT_FAILURE);
+	uint32_t n = pic.device().rowsize();
+	for( int i = 0; i < BENCH_RUNS; i++ ){
+		b.sample( "setPC", [&]{ pic.setPC( n * i ); } );
 	}
-	uint16_t getRevisionID(){
-		setPC( 0x8005 );
-		return (uint16_t)(readNVM() & 0x0fff);
+	for( int i = 0; i < BENCH_RUNS; i++ ){
+		b.sample( "writeNVM", [&]{ pic.writeNVM( row[i % n] ); } );
 	}
-
-	void getDIA(){
-		setPC( 0x8100 );
-		microid[9] = '\0';
-		for( int i = 0; i < 9; i++ ){
-			microid[i] = (uint16_t)readNVM();
-		}
-		setPC( 0x810a );
-		extuid[8] = '\0';
-		for( int i = 0; i < 8; i++ ){
-			extuid[i] = (uint16_t)readNVM();
-		}
+	pic.setPC( 0 );
+	for( int i = 0; i < BENCH_RUNS; i++ ){
+		b.sample( "readNVM", [&]{ pic.readNVM(); } );
 	}
-
-	void printDCI(FILE *fp){
-		fprintf(fp, "Erase Row Size: %d words\n",ersiz);
-		fprintf(fp, "Number of write latches per row: %d words\n",wlsiz);
-		fprintf(fp, "Number of user erasable rows: %d rows\n",ursiz);
-		fprintf(fp, "Data EEPROM memory size: %d bytes\n",eesiz);
-		fprintf(fp, "Pin Count: %d pins\n", pcnt);
+	for( int i = 0; i < BENCH_RUNS; i++ ){
+		b.sample( "getDCI", [&]{ pic.getDCI(); } );
 	}
-
-	void getDCI(){
-		setPC( 0x8200 ); ersiz = readNVM();
-		setPC( 0x8201 ); wlsiz = readNVM();
-		setPC( 0x8202 ); ursiz = readNVM();
-		setPC( 0x8203 ); eesiz = readNVM();
-		setPC( 0x8204 ); pcnt = readNVM();
+	pic.setPC( 0 ); //program memory only
+	for( int i = 0; i < BENCH_SLOW; i++ ){
+		b.sample( "bulkErase", [&]{ pic.bulkErase(); } );
 	}
-
-	void powerOn(){
-		m_mclr.setDirection(Pin::OUTPUT);
-		m_pwr.setDirection(Pin::OUTPUT);
-		m_mclr.setVoltage(Pin::VHIGH);
-		m_pwr.setVoltage(Pin::VHIGH);
+	for( int i = 0; i < BENCH_SLOW; i++ ){
+		b.sample( "writeRow", [&]{ pic.writeRow( n * i, row, n ); } );
 	}
-
-	void stop(){
-		vppFirstExit();
-		m_mclr.setDirection(Pin::OUTPUT);
-		m_pwr.setDirection(Pin::OUTPUT);
-		m_clock.setDirection(Pin::OUTPUT);
-		m_data.setDirection(Pin::OUTPUT);
+	for( int i = 0; i < BENCH_SLOW; i++ ){
+		pic.setPC( 0 );
+		pic.bulkErase();
+		b.sample( "uploadMain", [&]{ pic.uploadMain( img ); } );
 	}
+	pic.stop();
+}
 
-	std::vector<uint32_t> mem;
-protected:
-	void write( uint32_t word, unsigned int numberofbits = 8 ){
-		m_clock.setDirection(Pin::OUTPUT);
-		m_data.setDirection(Pin::OUTPUT);
-		for( int i = numberofbits - 1; i >= 0; i-- ){ //index 13 -> 0
-
-
-			uint32_t bit = (word & (0x0001 << i)) >> i;
-			m_data.setVoltage( bit == 0x0001 ? Pin::VHIGH : Pin::VLOW );
-
-			m_clock.setVoltage(Pin::VHIGH);
-			usleep( TCKH );
+static Capture* s_capture = NULL;
+static const char* s_capturefile = NULL;
+static void finishCapture(){
+	s_capture->stop();
+	s_capture->vcd( s_capturefile );
+	s_capture->measure( stdout );
+}
 
-			m_clock.setVoltage(Pin::VLOW);
-			usleep( TCKL );
+int main( int argc, char** argv ){
+
+	bool compiled = false;
+	bool incremental = false;
+	bool usefixed = false;
+	bool realtime = false;
+	bool spi = false;
+	bool emulate = false;
+	int guard = -1;
+	const char* benchfile = NULL;
+	const char* tracefile = NULL;
+	const char* capturefile = NULL;
+	const char* dumpfile = NULL;
+	const char* socketpath = NULL;
+	int spot = -1;
+	bool quiet = false;
+	const char* logfile = NULL;
+	uint64_t simcycles = 0;
+	uint64_t simirq = 0;
+	int cpu = -1;
+	Verify::Mode verifymode = Verify::FULL;
+	uint8_t gang[GANG_MAX];
+	int gangsize = 0;
+	int opt;
+	while( (opt = getopt( argc, argv, "a:b:cd:efig:j:k:l:qr:st:u:v:x:" )) != -1 ){
+		switch( opt ){
+			case 'a': capturefile = optarg; break;
+			case 'b': benchfile = optarg; break;
+			case 'c': compiled = true; break;
+			case 'd': dumpfile = optarg; break;
+			case 'e': emulate = true; break;
+			case 'f': usefixed = true; break;
+			case 'i': incremental = true; break;
+			case 'j': logfile = optarg; break;
+			case 'l': socketpath = optarg; break;
+			case 'q': quiet = true; break;
+			case 'k': guard = atoi( optarg ); break;
+			case 's': spi = true; break;
+			case 't': tracefile = optarg; break;
+			case 'u': spot = atoi( optarg ); break;
+			case 'x':{
+				char* irq = strchr( optarg, ',' );
+				simcycles = strtoull( optarg, NULL, 0 );
+				if( irq ) simirq = strtoull( irq + 1, NULL, 0 );
+				break;
+			}
+			case 'r':
+				realtime = true;
+				cpu = atoi( optarg );
+				break;
+			case 'v':
+				if( !Verify::parse( optarg, verifymode ) ){
+					fprintf(stderr, "Unknown verify mode %s\n", optarg);
+					return 1;
+				}
+				break;
+			case 'g':
+				for( char* tok = strtok( optarg, "," ); tok; tok = strtok( NULL, "," ) ){
+					if( gangsize == GANG_MAX ) break;
+					char* end;
+					long pin = strtol( tok, &end, 10 );
+					if( *end != '\0' ){
+						fprintf(stderr, "Gang data GPIO %s is not a number\n", tok);
+						return 1;
+					}
+					if( !Gang::usable( pin, gang, gangsize ) ) return 1;
+					gang[gangsize++] = pin;
+				}
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-a out.vcd] [-b out.json] [-c] [-d out.hex] [-e] [-f] [-i] [-j log.json] [-k guard%%] [-l socket] [-q] [-r cpu] [-s] [-t trace.json] [-u rows] [-v full|crc|none] [-x cycles[,irq]] [-g data,data,...] [file.hex]\n", argv[0]);
+				fprintf(stderr, "  -a  sample the ICSP lines on another core, VCD and margins on exit\n");
+				fprintf(stderr, "  -b  benchmark the primitives and an upload, JSON to out.json (- for stdout)\n");
+				fprintf(stderr, "  -c  compile the session once, replay it per board\n");
+				fprintf(stderr, "  -d  read the whole part out to Intel HEX (- for stdout) and stop\n");
+				fprintf(stderr, "  -e  program an emulated target instead of the GPIO pins\n");
+				fprintf(stderr, "  -f  program the compile time test firmware\n");
+				fprintf(stderr, "  -i  only rewrite rows that differ from the device\n");
+				fprintf(stderr, "  -j  write progress as JSON lines to log.json (- for stdout)\n");
+				fprintf(stderr, "  -k  calibrate erase/program dwells for this part, plus guard %%\n");
+				fprintf(stderr, "  -l  serve program/verify/read jobs on a Unix socket (e.g. %s)\n", DAEMON_SOCKET);
+				fprintf(stderr, "  -q  quiet: no per-row or per-word progress\n");
+				fprintf(stderr, "  -r  real-time: lock memory, SCHED_FIFO, pin to cpu (-1 any)\n");
+				fprintf(stderr, "  -s  shift commands through %s instead of bit-banging\n", SPI_DEVICE);
+				fprintf(stderr, "  -t  record every ICSP command, written as a Chrome trace on exit\n");
+				fprintf(stderr, "  -u  stamp an image fingerprint in the user IDs; skip parts that carry it\n");
+				fprintf(stderr, "      once this many rows spot check (0 trusts the stamp)\n");
+				fprintf(stderr, "  -v  verify program memory after writing (default full)\n");
+				fprintf(stderr, "  -x  run the image on the host for this many cycles and profile it,\n");
+				fprintf(stderr, "      raising INTF every irq cycles; no target needed\n");
+				fprintf(stderr, "  -g  gang program one target per listed data GPIO\n");
+				return 1;
 		}
 	}
-	uint32_t read( unsigned int numberofbits = 8){
-		uint32_t ret = 0;
-		m_clock.setDirection(Pin::OUTPUT);
-		m_data.setDirection(Pin::INPUT);
-		for( int i = numberofbits - 1; i >= 0; i-- ){
-
-			m_clock.setVoltage(Pin::VHIGH);
-			usleep( TCKH );
-
-			m_clock.setVoltage(Pin::VLOW);
-			ret |= m_data.readVoltage() << i;
-			usleep( TCKL );
-		}
-		//Ignore start and stop bit
-		ret &= ~(0x01 << (numberofbits - 1)); //mask (first) start bit
-		return ret >> 1; //shift over last (stop) bit
-	}
-
-	void vppFirstEntry(){
-		m_mclr.setDirection(Pin::OUTPUT);
-		m_clock.setDirection(Pin::OUTPUT);
-		m_data.setDirection(Pin::OUTPUT);
-		m_pwr.setDirection(Pin::OUTPUT);
-
-		m_mclr.setVoltage(Pin::VLOW);
-		m_clock.setVoltage(Pin::VLOW);
-		m_data.setVoltage(Pin::VLOW);
-		m_pwr.setVoltage(Pin::VLOW);
-
-		m_mclr.setVoltage(Pin::VHIGH);
-		usleep(TENTS);
-		m_pwr.setVoltage(Pin::VHIGH);
-		usleep(TENTH);
-		m_data.setVoltage(Pin::VHIGH);
-		m_clock.setVoltage(Pin::VHIGH);
-		usleep(TCKH);
-		m_clock.setVoltage(Pin::VLOW);
-		usleep(TCKL);
-
-		usleep(10000);
-	}
-	void vppFirstExit(){
-		m_open = false;
-		m_mclr.setDirection(Pin::OUTPUT);
-		m_clock.setDirection(Pin::OUTPUT);
-		m_data.setDirection(Pin::OUTPUT);
-		m_pwr.setDirection(Pin::OUTPUT);
-
-		m_clock.setVoltage(Pin::VLOW);
-		usleep(TCKL);
-		m_clock.setVoltage(Pin::VHIGH);
-		usleep(TCKH);
-		m_clock.setVoltage(Pin::VLOW);
-		m_data.setVoltage(Pin::VLOW);
-		m_pwr.setVoltage(Pin::VLOW);
-		usleep(TEXIT);
-		m_mclr.setVoltage(Pin::VLOW);
-	}
-	
-private:
-	uint16_t microid[10];
-	uint16_t extuid[9];
-	uint16_t ersiz;
-	uint16_t wlsiz;
-	uint16_t ursiz;
-	uint16_t eesiz;
-	uint16_t pcnt;
-
-	typedef struct funclocats{
-		uint32_t addr;
-		const char* name;
-		bool call;
-		funclocats( uint32_t a, const char* n, bool c = false ){
-			addr = a;
-			name = n;
-			call = c;
-		}
-	}Functions;
-	std::vector<Functions> m_func;
-
-	bool m_open;
-
-	Pin m_clock;
-	Pin m_data;
-	Pin m_mclr;
-	Pin m_pwr;
-};
-
-
-using namespace Instructions;
-int main( __attribute__((unused))int argc, __attribute__((unused))char** argv ){
 
 	uint32_t config[] = {
 		0x0111, //0x8007
@@ -534,51 +517,72 @@ int main( __attribute__((unused))int argc, __attribute__((unused))char** argv ){
 	uint32_t userid[] = {
 		'M', 'a', 'r', 'k'
 	};
+	uint32_t defid[4], defcfg[5];	//for images the service loads
+	memcpy( defid, userid, sizeof(defid) );
+	memcpy( defcfg, config, sizeof(defcfg) );
+	/* -d - and -b - own stdout: the HEX or JSON goes to a copy of it and
+	 * every status line, whoever prints it, to stderr */
+	FILE* console = NULL;
+	if( ( dumpfile && strcmp( dumpfile, "-" ) == 0 ) || ( benchfile && strcmp( benchfile, "-" ) == 0 ) ){
+		fflush( stdout );
+		console = fdopen( dup( STDOUT_FILENO ), "w" );
+		dup2( STDERR_FILENO, STDOUT_FILENO );
+	}
+	/* Progress is formatted off the programming thread */
+	FILE* logfp = stdout;
+	if( logfile && strcmp( logfile, "-" ) != 0 && (logfp = fopen( logfile, "w" )) == NULL ){
+		fprintf(stderr, "Cannot write %s\n", logfile);
+		return 1;
+	}
+	Log::start( quiet ? Log::INFO : Log::WORD, logfp, logfile != NULL );
+	atexit( Log::stop );
 
-#if 0
-	uint32_t test[30];
-	test[ 0] = NOP();
-	test[ 1] = BRA(5);
-	test[ 2] = NOP();
-	test[ 3] = NOP();
-	test[ 4] = MOVLP(0);
-	test[ 5] = CALL(0x1a);
-	test[ 6] = RETFIE();
-	test[ 7] = MOVLB(0);
-	test[ 8] = MOVLW(0x01);
-	test[ 9] = MOVWF(TRISB.addr);
-	test[10] = MOVLW(0x00);
-	test[11] = MOVWF(TRISC.addr);
-	test[12] = MOVWF(LATC.addr);
-	test[13] = MOVLB(14);
-	test[14] = MOVLW(0);
-	test[15] = MOVWF(PIR0.addr);
-	test[16] = MOVLW(0x01);
-	test[17] = MOVWF(PIE0.addr);
-	test[18] = MOVLB(0);
-	test[19] = BSF(7, INTCON.addr);
-	test[20] = CLRWDT();
-	test[21] = MOVLB(14);
-	test[22] = MOVF(0,PIR0.addr);
-	test[23] = MOVLB(0);
-	test[24] = MOVWF(LATC.addr);
-	test[25] = BRA(-6);
-	test[26] = MOVLB(0);
-	test[27] = MOVLW(0xce);
-	test[28] = MOVWF(PORTC.addr);
-	test[29] = RETURN();
-
-	for( int i = 0; i < 30; i++){
-		fprintf(stdout, "%04x\n", test[i]);
+	/* The simulator needs no target and ignores everything about one */
+	if( simcycles && ( realtime || spi || compiled || gangsize > 0 || capturefile || socketpath ||
+			benchfile || dumpfile || guard >= 0 ) ){
+		fprintf(stderr, "-x runs on the host and cannot be combined with -a, -b, -c, -d, -g, -k, -l, -r or -s\n");
+		return 1;
+	}
+	if( realtime ){
+		Realtime::enter( cpu );
+		Timing::track( true );
+		atexit( reportJitter );
 	}
-	return 1;
-#endif
 
-	Programmer pic;
+	/* Sessions replay and gangs run on the GPIO pins only */
+	if( emulate && ( spi || compiled || gangsize > 0 || capturefile ) ){
+		fprintf(stderr, "-e cannot be combined with -a, -c, -s or -g\n");
+		return 1;
+	}
+	Transport *wire;
+	BitBang *gpio = NULL;
+	Target *target = NULL;
+	if( emulate || simcycles ) wire = target = new Target();	//-x only needs a Programmer to assemble with
+	else wire = gpio = new BitBang();
+	if( spi ) wire = new SPITransport( *new Spidev(), *gpio );
+	Meter meter( *wire );
+	Programmer pic( benchfile ? (Transport&)meter : *wire );
+	Pipeline pipeline;
+	pic.pipeline( &pipeline );
+	if( tracefile ){
+		s_trace = new Trace();
+		s_tracefile = tracefile;
+		pic.trace( s_trace );
+		atexit( dumpTrace );
+	}
+	if( capturefile ){
+		/* Sample on the last core that isn't running the session */
+		int n = sysconf( _SC_NPROCESSORS_ONLN );
+		int core = n - 1 == cpu ? n - 2 : n - 1;
+		s_capture = new Capture();
+		s_capturefile = capturefile;
+		s_capture->start( core >= 0 ? core : -1 );
+		atexit( finishCapture );
+	}
 
 	/********** CONFIGURE VECTORS **********/
 	pic.addCMD( 0x0000  );
-	pic.addCMD( GOTO(0) );
+	pic.addCMD( GOTO(0), "start", true );
 	pic.addCMD( 0x0000  );
 	pic.addCMD( 0x0000  );
 	pic.addCMD( NOP(), "interrupt" );
@@ -592,8 +596,7 @@ int main( __attribute__((unused))int argc, __attribute__((unused))char** argv ){
 	pic.addCMD( RETFIE() );
 
 	/********** INITIALIZE PORTS  **********/
-	uint32_t sop = pic.addCMD( 0x0000  );
-	pic.mem[1] = GOTO(sop);
+	pic.addCMD( 0x0000, "start" );
 	pic.addCMD( MOVLB(62) );
 	pic.addCMD( CLRF( 0x43) );
 	pic.addCMD( MOVLB(0) );
@@ -641,7 +644,7 @@ int main( __attribute__((unused))int argc, __attribute__((unused))char** argv ){
 	pic.addCMD( CALL(0), "RA1low", true);
 
 	/**********   SPIN LOOP       **********/
-	pic.addCMD( NOP() );
+	pic.addCMD( NOP(), "spin" );
 	pic.addCMD( CLRWDT() );
 	pic.addCMD( CALL(0), "RA2high", true);
 	pic.addCMD( CALL(0), "RA2low", true);
@@ -656,7 +659,7 @@ int main( __attribute__((unused))int argc, __attribute__((unused))char** argv ){
 	pic.addCMD(NOP());
 	pic.addCMD(NOP());
 #endif
-	pic.addCMD( BRA(-11));
+	pic.addCMD( BRA(0), "spin", true );
 
 	/*<><><><><> F U N C T I O N S <><><><><>*/
 
@@ -693,56 +696,145 @@ int main( __attribute__((unused))int argc, __attribute__((unused))char** argv ){
 	pic.addCMD(MOVLB(0)); //reset back Bank
 	pic.addCMD( RETURN() );
 
-
-
-
-	pic.start(); //&Enter programming mode
-
-	pic.setPC(0x8000); //according to table 3-2. This will erase all memory
-	pic.bulkErase();
-	//Write Program Memory
-	//Verify Program Memory
-	pic.uploadMain();
-	//Write User IDs
-	//Verify User Ids
-	//Write Configuration words
-	//verify configuration words
-	
-	pic.setPC(0x8000);
-	for( int i = 0; i < 4; i++ ){
-		pic.writeNVM( userid[i] );
-		pic.beginIntProgramming();
-		usleep( TPINT ); //probably redundant
-		uint32_t ret = pic.readNVM();
-		if( ret != userid[i] ){
-			fprintf(stderr, "Failed to write userID\n");
+	/* A hex file replaces the built-in program, user IDs and config it defines */
+	Image image;
+	if( optind < argc ){
+		nsec_t t = Timing::now();
+		if( !Hex::load( argv[optind], image ) ) return 1;
+		t = Timing::now() - t;
+		fprintf(stdout, "Loaded %s: %u rows in %" PRIu64 " us\n", argv[optind], image.rows(), t / USEC);
+		idsFrom( image, userid, config );
+	}
+	else if( usefixed ) image.load( fixed.data(), fixed.size() );
+	else pic.link( image );
+
+	if( spot >= 0 ){
+		if( image.userids() ) fprintf(stdout, "User IDs in the image replaced by the fingerprint\n");
+		Fingerprint::stamp( image, config, userid );
+		Fingerprint::print( stdout, userid );
+	}
+
+	if( simcycles ){
+		Sim sim( image );
+		if( optind >= argc && !usefixed ) sim.labels( pic.assembler().symbols() );
+		sim.interrupt( simirq );
+		nsec_t t = Timing::now();
+		sim.run( simcycles );
+		t = Timing::now() - t;
+		sim.report( stdout );
+		fprintf(stdout, "Emulated in %" PRIu64 " us\n", t / USEC);
+		return 0;
+	}
+
+
+
+
+	if( socketpath ){
+		Daemon daemon( socketpath );
+		Resident builtin;
+		builtin.image = image;
+		memcpy( builtin.userid, userid, sizeof(builtin.userid) );
+		memcpy( builtin.config, config, sizeof(builtin.config) );
+		serve( pic, daemon, builtin, defid, defcfg, spot );
+		return 0;
+	}
+
+	if( benchfile ){
+		Bench bench( meter );
+		benchmark( pic, bench, image );
+		if( target ) target->print( stdout );
+		const char* transport = emulate ? "emulated" : spi ? "spi" : "gpio";
+		if( console ){
+			bench.write( console, transport );
+			fclose( console );
+			return 0;
 		}
-		fprintf(stdout, "Ret: %04x - uid: %04x\n", ret, userid[i]);
-		pic.incPC();
+		return bench.write( benchfile, transport ) ? 0 : 1;
+	}
+
+	if( gangsize > 0 ){
+		Gang g( gang, gangsize );
+		g.start();
+		const Device& d = g.device();
+		uint32_t n = d.rowsize();
+		image.regroup( n );
+		if( image.end() > d.words() ){
+			fprintf(stderr, "Image ends at %04x, %s has %u words\n", image.end(), d.name(), d.words());
+			g.stop();
+			return 1;
+		}
+		g.setPC(0x8000);
+		g.bulkErase();
+		for( uint32_t r = image.first(); r != Image::NOROW && g.alive(); r = image.next( r ) ){
+			if( !image.blank( r ) ) g.writeRow( n*r, image.row( r ), n );
+		}
+		g.setPC(0x8000);
+		for( int i = 0; i < 4; i++ ) g.writeWord( userid[i], 0x3fff );
+		g.setPC(0x8007);
+		for( int i = 0; i < 5; i++ ) g.writeWord( config[i], config[i] );
+		g.stop();
+		Timing::wait(10 * MSEC);
+		g.powerOn();
+		g.report( stdout );
+		return 1;
 	}
 
-
-	fprintf(stdout, "\n");
-
-	pic.setPC(0x8007);
-	for( int i = 0; i < 5; i++ ){
-		pic.writeNVM( config[i] );
-		pic.beginIntProgramming();
-		usleep( TPINT ); //probably redundant
-		uint32_t ret = pic.readNVM();
-		if( (ret & config[i]) != config[i] ){
-			fprintf(stderr, "Failed to write configuration\n");
-		}
-		fprintf(stdout, "ret: %04x - conf: %04x\n", ret, config[i]);
-		pic.incPC();
+	if( compiled ){
+		Session session;
+		pic.compile( session, image, userid, config );
+		session.print( stdout );
+		char line[16];
+		do{
+			gpio->replay( session );
+			Timing::wait(10 * MSEC);
+			pic.powerOn();
+			fprintf(stdout, "Board done. Enter for the next board, ^D to quit\n");
+		}while( fgets( line, sizeof(line), stdin ) != NULL );
+		return 1;
 	}
 
-	//STOP is automatically done in the constructor
-	pic.stop();
+	pic.start(); //&Enter programming mode
+	if( !fit( pic, image ) ){
+		pic.stop();
+		return 1;
+	}
 
-	usleep(10000);
-	pic.powerOn();
-	
+	if( dumpfile ){
+		FILE* fp = console ? console : fopen( dumpfile, "w" );
+		if( fp == NULL ){
+			fprintf(stderr, "Cannot write %s\n", dumpfile);
+			return 1;
+		}
+		HexWriter hex( fp );
+		nsec_t t = Timing::now();
+		uint32_t n = pic.readout( hex );
+		t = Timing::now() - t;
+		fclose( fp );
+		pic.stop();
+		fprintf(stdout, "Read %u words in %" PRIu64 " ms\n", n, t / MSEC);
+		return 0;
+	}
+
+	if( guard >= 0 ){
+		Dwell d = pic.calibrate( guard );
+		Profile::save( pic.deviceID(), pic.revisionID(), d );
+		pic.stop();
+		if( target ) target->print( stdout );
+		return 0;
+	}
+
+	if( spot >= 0 && current( pic, image, userid, config, spot ) ){
+		fprintf(stdout, "Part already holds this image, nothing to program\n");
+		pic.stop();
+		Timing::wait(10 * MSEC);
+		pic.powerOn();
+		if( target ) target->print( stdout );
+		return 0;
+	}
+
+	Verify verify( verifymode );
+	flash( pic, image, userid, config, verify, incremental );
+	if( target ) target->print( stdout );
 
 	return 1;
 }
@@ -20,8 +20,14 @@ volatile unsigned *gpio;
 #define GPIO_SET *(gpio+7)
 #define GPIO_CLR *(gpio+10)
 #define GET_GPIO(g) (*(gpio+13)&(1<<g))
+#define GPIO_LEV *(gpio+13)
 #define GPIO_PULL *(gpio+37)
 
+#define GPIO_MCLR   9 
+#define GPIO_CLOCK 11 
+#define GPIO_DATA  10 
+#define GPIO_POWER 22
+
 
 class GPIO{
 public:
@@ -39,7 +45,7 @@ public:
 				NULL,
 				BLOCK_SIZE,
 				PROT_READ|PROT_WRITE,
-				MAP_SHARED,
+				MAP_SHARED | MAP_POPULATE,
 				m_fdmem,
 				GPIO_BASE
 			       );
@@ -49,6 +55,7 @@ public:
 			exit( EXIT_FAILURE );
 		}
 		gpio = (volatile unsigned*)gpio_map;
+		(void)*(gpio+13); //touch GPLEV0 so the first edge doesn't fault
 	}
 private:
 	bool m_init;
@@ -58,6 +65,7 @@ private:
 
 
 
+/* Voltage/direction names shared by every pin */
 class Pin{
 public:
 	typedef enum{
@@ -66,43 +74,84 @@ public:
 	typedef enum{
 		INPUT = 1, OUTPUT = 0
 	}Direction;
-	Pin(int gpioPinNumber):m_pin(gpioPinNumber){
-		pinout.init();
-		setDirection(Direction::OUTPUT);
-	}
-	Pin(){
-		pinout.init();
-		m_pin = 0;
+	typedef enum{
+		FSEL_INPUT = 0, FSEL_OUTPUT = 1, FSEL_ALT0 = 4
+	}Function;
+
+	/* Move several pins with one store per register. Pins in both
+	 * masks end up low. */
+	static inline void drive( uint32_t set, uint32_t clr ){
+		if( set ) GPIO_SET = set;
+		if( clr ) GPIO_CLR = clr;
 	}
-	Pin( const Pin& p ){
-		pinout = p.pinout;
-		m_pin = p.m_pin;
+	static inline uint32_t levels(){
+		return GPIO_LEV;
 	}
-	void setDirection(Direction d){
-		INP_GPIO(m_pin);
-		if( d == OUTPUT ) OUT_GPIO(m_pin);
+	/* Hand a pin to a peripheral (or back). GPIOPin caches are not updated */
+	static void setFunction( uint8_t n, Function f ){
+		volatile unsigned *fsel = gpio + (n / 10);
+		*fsel = ( *fsel & ~(7 << ((n % 10) * 3)) ) | ( f << ((n % 10) * 3) );
 	}
-	void setVoltage( Voltage v ){
-		if( v == VHIGH ){
-			GPIO_SET = 1 << m_pin;
-		}
-		else{
-			GPIO_CLR = 1 << m_pin;
+	/* Set the direction of every pin in mask, one GPFSEL write per bank
+	 * of ten. GPIOPin caches are not updated. */
+	static void setDirection( uint32_t mask, Direction d ){
+		for( int reg = 0; reg < 4; reg++ ){
+			unsigned clr = 0, set = 0;
+			for( int n = reg * 10; n < reg * 10 + 10 && n < 32; n++ ){
+				if( !( mask & (1u << n) ) ) continue;
+				clr |= 7 << ((n % 10) * 3);
+				if( d == OUTPUT ) set |= 1 << ((n % 10) * 3);
+			}
+			if( clr ) *(gpio + reg) = ( *(gpio + reg) & ~clr ) | set;
 		}
+		if( d == INPUT ) GPIO_PULL = 0;
 	}
-	Voltage readVoltage(){
-		GPIO_PULL = 0;
-		int i = GET_GPIO(m_pin);
-		if( i > 0 ) return Voltage::VHIGH;
-		return Voltage::VLOW;
+	static GPIO pinout;
+};
+GPIO Pin::pinout;
+
+/*
+ * A pin bound to its BCM number at compile time. The set/clear mask is a
+ * constant and the last direction written to GPFSEL is cached, so steady
+ * state bit-banging never touches GPFSEL again.
+ */
+template<uint8_t N>
+class GPIOPin : public Pin{
+public:
+	static const uint32_t mask = 1u << N;
+	static const uint8_t  number = N;
+
+	GPIOPin(){
+		pinout.init();
+		setDirection(Direction::OUTPUT);
 	}
-	~Pin(){
+	static inline void setDirection(Direction d){
+		if( s_known && s_dir == d ) return;
+		volatile unsigned *fsel = gpio + (N / 10);
+		unsigned bits = *fsel & ~(7 << ((N % 10) * 3));
+		if( d == OUTPUT ) bits |= (1 << ((N % 10) * 3));
+		else GPIO_PULL = 0;
+		*fsel = bits;
+		s_dir = d;
+		s_known = true;
+	}
+	/* Forget the cached direction after someone else touched GPFSEL */
+	static inline void invalidate(){
+		s_known = false;
+	}
+	static inline void setVoltage( Voltage v ){
+		if( v == VHIGH ) GPIO_SET = mask;
+		else GPIO_CLR = mask;
+	}
+	static inline Voltage readVoltage(){
+		return ( GPIO_LEV & mask ) ? Voltage::VHIGH : Voltage::VLOW;
 	}
-	static GPIO pinout;
 private:
-	int m_pin;
+	static Direction s_dir;
+	static bool s_known;
 };
-GPIO Pin::pinout;
+template<uint8_t N> Pin::Direction GPIOPin<N>::s_dir = Pin::OUTPUT;
+template<uint8_t N> bool GPIOPin<N>::s_known = false;
 
 
 #endif
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <string.h>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+#include "realtime.h"
+
+#ifndef __PIPELINE_HEADER__
+#define __PIPELINE_HEADER__
+
+#define PIPELINE_DEPTH 64	//tasks in flight before post() waits
+
+/*
+ * Host work taken off the wire thread.
+ *
+ * The thread driving ICSP posts what doesn't have to happen between two
+ * commands (comparing a row it just read, printing progress) and goes
+ * straight back to shifting bits; one worker runs the tasks in order.
+ * Posting only queues: the worker is woken by kick() as the wire thread
+ * goes into a dwell, or once the ring is half full, so there is no
+ * wake-up per task on the critical path. The worker drops to
+ * SCHED_OTHER, so next to a SCHED_FIFO wire thread on the same core (-r)
+ * it only gets the CPU while that thread sleeps through
+ * TERAB/TERAR/TPINT, and never stretches a hold. drain() waits until
+ * everything posted has run.
+ */
+class Pipeline{
+public:
+	typedef std::function<void()> Task;
+
+	Pipeline(){
+		m_ring.resize( PIPELINE_DEPTH );
+		m_head = 0;
+		m_tail = 0;
+		m_busy = false;
+		m_stop = false;
+		m_worker = std::thread( &Pipeline::run, this );
+	}
+	~Pipeline(){
+		drain();
+		{
+			std::lock_guard<std::mutex> lock( m_lock );
+			m_stop = true;
+		}
+		m_posted.notify_one();
+		m_worker.join();
+	}
+
+	void post( const Task& t ){
+		std::unique_lock<std::mutex> lock( m_lock );
+		m_done.wait( lock, [this]{ return m_head - m_tail < PIPELINE_DEPTH; } );
+		m_ring[m_head % PIPELINE_DEPTH] = t;
+		m_head++;
+		if( m_head - m_tail >= PIPELINE_DEPTH / 2 ) m_posted.notify_one();
+	}
+	/* Start on whatever is queued, e.g. before a long dwell */
+	void kick(){
+		std::lock_guard<std::mutex> lock( m_lock );
+		if( m_head != m_tail ) m_posted.notify_one();
+	}
+	void drain(){
+		std::unique_lock<std::mutex> lock( m_lock );
+		if( m_head != m_tail ) m_posted.notify_one();
+		m_done.wait( lock, [this]{ return m_head == m_tail && !m_busy; } );
+	}
+
+private:
+	void run(){
+		Realtime::background();
+		std::unique_lock<std::mutex> lock( m_lock );
+		for( ;; ){
+			m_posted.wait( lock, [this]{ return m_head != m_tail || m_stop; } );
+			if( m_head == m_tail ) return;
+			Task t;
+			t.swap( m_ring[m_tail % PIPELINE_DEPTH] );
+			m_tail++;
+			m_busy = true;
+			lock.unlock();
+			t();
+			lock.lock();
+			m_busy = false;
+			m_done.notify_all();
+		}
+	}
+
+	std::vector<Task> m_ring;
+	size_t m_head;
+	size_t m_tail;
+	bool m_busy;
+	bool m_stop;
+	std::mutex m_lock;
+	std::condition_variable m_posted;
+	std::condition_variable m_done;
+	std::thread m_worker;
+};
+
+#endif
@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <vector>
+
+#include "timing.h"
+#include "instructions.h"
+#include "image.h"
+#include "device.h"
+#include "dwell.h"
+
+#ifndef __PLAN_HEADER__
+#define __PLAN_HEADER__
+
+/*
+ * How to get an image onto a part for the least time on the wire.
+ *
+ *   ALL      SETPC 0x8000 + BULKERASE: program memory, user IDs and config
+ *            go; all of them are written back
+ *   PROGRAM  SETPC 0 + BULKERASE: program memory only; user IDs and config
+ *            are left standing and only words that differ are written
+ *   ROWS     ROWERASE and rewrite only the rows that differ; needs the
+ *            image rows read back first and leaves rows outside the
+ *            image alone
+ *
+ * A row is always erased before it is written unless it reads back
+ * blank: the programming spec has no reprogramming of written words.
+ * A config word that needs a 0 back at 1 forces ALL; user IDs that do
+ * can be erased as a row at 0x8000.
+ * Costs are the dwells in use plus the bits and delays every command
+ * puts on the wire.
+ */
+class Planner{
+public:
+	typedef enum{
+		ALL, PROGRAM, ROWS, STRATEGIES
+	}Strategy;
+	typedef struct plan{
+		Strategy strategy;
+		std::vector<uint32_t> erase;	//rows to erase first (ROWS)
+		std::vector<uint32_t> write;	//rows to program
+		bool iderase;		//row erase the user IDs
+		uint32_t idmask;	//user ID words to write
+		uint32_t cfgmask;	//config words to write
+		nsec_t cost;
+		nsec_t costs[STRATEGIES];	//0 where a strategy cannot do the job
+	}Plan;
+
+	Planner( const Device& d, const Dwell& dwell ){
+		m_device = &d;
+		m_dwell = dwell;
+	}
+
+	/* curid/curcfg are the user IDs and config on the part; readback the
+	 * image rows as read from it, or NULL if only a bulk erase will do */
+	Plan plan( const Image& img, const uint32_t* userid, const uint32_t* config,
+			const uint32_t* curid, const uint32_t* curcfg, const Image* readback ) const{
+		Plan all = { ALL, {}, {}, false, 0xf, 0x1f, 0, {} };
+		for( uint32_t r = img.first(); r != Image::NOROW; r = img.next( r ) ){
+			if( !img.blank( r ) ) all.write.push_back( r );
+		}
+		all.cost = bulk() + rows( img, all.write ) + words( 4 ) + words( 5 );
+
+		/* Anything short of a full erase keeps user IDs and config */
+		Plan keep = all;
+		keep.idmask = 0;
+		keep.cfgmask = 0;
+		bool cfgok = true;
+		for( int i = 0; i < 5; i++ ){
+			if( config[i] & ~curcfg[i] ) cfgok = false;
+			else if( config[i] != curcfg[i] ) keep.cfgmask |= 1 << i;
+		}
+		for( int i = 0; i < 4; i++ ){
+			if( userid[i] & ~curid[i] ) keep.iderase = true;
+		}
+		for( int i = 0; i < 4; i++ ){
+			if( keep.iderase ? userid[i] != ERASED : userid[i] != curid[i] ) keep.idmask |= 1 << i;
+		}
+		nsec_t ids = ( keep.iderase ? erase( 1 ) : 0 ) + words( count( keep.idmask ) ) + words( count( keep.cfgmask ) );
+
+		nsec_t costs[STRATEGIES] = { all.cost, 0, 0 };
+		Plan best = all;
+		if( cfgok ){
+			Plan prog = keep;
+			prog.strategy = PROGRAM;
+			prog.cost = bulk() + rows( img, prog.write ) + ids;
+			costs[PROGRAM] = prog.cost;
+			if( prog.cost < best.cost ) best = prog;
+		}
+		if( cfgok && readback ){
+			Plan rows = keep;
+			rows.strategy = ROWS;
+			rows.write.clear();
+			uint32_t n = img.rowsize();
+			for( uint32_t r = img.first(); r != Image::NOROW; r = img.next( r ) ){
+				const uint32_t *want = img.row( r ), *dev = readback->row( r );
+				bool differ = false;
+				for( uint32_t i = 0; i < n; i++ ){
+					if( dev[i] != want[i] ) differ = true;
+				}
+				if( !differ ) continue;
+				if( !readback->blank( r ) ) rows.erase.push_back( r );
+				if( !img.blank( r ) ) rows.write.push_back( r );
+			}
+			rows.cost = erase( rows.erase.size() ) + this->rows( img, rows.write ) + ids;
+			costs[ROWS] = rows.cost;
+			if( rows.cost < best.cost ) best = rows;
+		}
+		for( int s = 0; s < STRATEGIES; s++ ) best.costs[s] = costs[s];
+		return best;
+	}
+
+	static void print( FILE* fp, const Plan& p ){
+		static const char* name[] = { "full bulk erase", "program memory bulk erase", "row erase" };
+		fprintf(fp, "Plan: %s", name[p.strategy]);
+		if( p.strategy == ROWS ) fprintf(fp, " of %zu rows", p.erase.size());
+		fprintf(fp, ", write %zu rows, %u user IDs%s, %u config words: %.1f ms predicted\n",
+				p.write.size(), count( p.idmask ), p.iderase ? " (erased first)" : "",
+				count( p.cfgmask ), p.cost / (double)MSEC);
+		for( int s = 0; s < STRATEGIES; s++ ){
+			if( s == p.strategy ) continue;
+			if( p.costs[s] ) fprintf(fp, "  %s: %.1f ms\n", name[s], p.costs[s] / (double)MSEC);
+			else fprintf(fp, "  %s: not possible\n", name[s]);
+		}
+	}
+
+private:
+	static nsec_t bits( unsigned n ){ return n * ( TCKH + TCKL ); }
+	/* 8-bit command, then 24-bit payload, each followed by TDLY */
+	static nsec_t command(){ return bits( 8 ) + TDLY; }
+	static nsec_t payload(){ return command() + bits( PAYLOADSZ ) + TDLY; }
+	static unsigned count( uint32_t mask ){
+		unsigned n = 0;
+		for( ; mask; mask &= mask - 1 ) n++;
+		return n;
+	}
+
+	nsec_t bulk() const{
+		return payload() + bits( 8 ) + m_dwell.erab;
+	}
+	nsec_t erase( size_t rows ) const{
+		return rows * ( payload() + bits( 8 ) + m_dwell.erar );
+	}
+	/* As loadRow() sends them: per non-blank latch load, SETPC, the words,
+	 * SETPC and a programming cycle */
+	nsec_t rows( const Image& img, const std::vector<uint32_t>& list ) const{
+		uint32_t latches = m_device->latches();
+		nsec_t t = 0;
+		for( size_t k = 0; k < list.size(); k++ ){
+			const uint32_t* w = img.row( list[k] );
+			for( uint32_t at = 0; at < img.rowsize(); at += latches ){
+				uint32_t n = img.rowsize() - at < latches ? img.rowsize() - at : latches;
+				bool blank = true;
+				for( uint32_t i = 0; i < n; i++ ){
+					if( w[at + i] != ERASED ) blank = false;
+				}
+				if( blank ) continue;
+				t += 2 * payload() + n * payload() + bits( 8 ) + m_dwell.pint;
+			}
+		}
+		return t;
+	}
+	/* User ID/config words as flash() writes them: load, program, read
+	 * back, INCPC, with one SETPC per group */
+	nsec_t words( unsigned n ) const{
+		if( n == 0 ) return 0;
+		return payload() + n * ( 2 * payload() + bits( 8 ) + m_dwell.pint + command() );
+	}
+
+	const Device* m_device;
+	Dwell m_dwell;
+};
+
+#endif
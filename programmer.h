@@ -0,0 +1,607 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <vector>
+
+#include "pic.h"
+#include "timing.h"
+#include "session.h"
+#include "instructions.h"
+#include "verify.h"
+#include "image.h"
+#include "hex.h"
+#include "assembler.h"
+#include "transport.h"
+#include "trace.h"
+#include "dwell.h"
+#include "device.h"
+#include "pipeline.h"
+#include "log.h"
+
+#ifndef __PROGRAMMER_HEADER__
+#define __PROGRAMMER_HEADER__
+
+/*
+ * ICSP sessions on a PIC16F152xx over any Transport: entry and exit,
+ * the NVM commands, row loads, verify, readout and dwell calibration,
+ * plus the assembler that builds the built-in firmware.
+ */
+class Programmer{
+public:
+	Programmer( Transport& wire ){
+		m_open = false;
+		m_wire = &wire;
+		m_trace = NULL;
+		m_pipe = NULL;
+		m_dwell = SPEC_DWELL;
+		m_devid = 0;
+		m_revid = 0;
+		m_probed = false;
+		Timing::calibrate();
+	}
+	/* Append an instruction. With func, either define the label func at
+	 * this word or, if resolve, make this CALL/GOTO/BRA target func */
+	uint32_t addCMD( uint32_t cmd, const char* func = NULL, bool resolve = false ){
+		if( func != NULL ){
+			if( resolve ) return m_asm.branch( cmd, func );
+			if( !m_asm.label( func ) ) exit(EXIT_FAILURE);
+		}
+		return m_asm.emit( cmd );
+	}
+	/* Resolve labels and load the program into a sparse image */
+	void link( Image& img ){
+		if( !m_asm.link( img ) ){
+			fprintf(stderr, "Failed to link program\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	Assembler& assembler(){
+		return m_asm;
+	}
+	/* Program an image into a freshly erased part. Rows that are absent
+	 * or all erased are never sent */
+	void uploadMain( const Image& img ){
+		uint32_t n = img.rowsize();
+		for( uint32_t r = img.first(); r != Image::NOROW; r = img.next( r ) ){
+			if( img.blank( r ) ) continue;
+			Log::row( r, n*r );
+			if( !loadRow( n*r, img.row( r ), n ) ){
+				fprintf(stderr, "Failed to write to memory\n");
+			}
+		}
+	}
+	void uploadMain(){
+		Image img;
+		link( img );
+		uploadMain( img );
+	}
+
+	/* The part's contents at the image's rows, grouped the same way */
+	void readRows( const Image& img, Image& out ){
+		uint32_t dev[DEVICE_MAXROW];
+		uint32_t n = img.rowsize();
+		out = Image( n );
+		for( uint32_t r = img.first(); r != Image::NOROW; r = img.next( r ) ){
+			readNVM( n*r, dev, n );
+			out.load( dev, n, n*r );
+		}
+	}
+
+	/* Read the image back, one SETPC + READNVM_INCPC burst per run of
+	 * consecutive rows. Each row is compared by the pipeline while the
+	 * next one comes off the wire */
+	bool verify( const Image& img, Verify& v ){
+		v.begin();
+		if( v.mode() == Verify::SKIP ) return true;
+		uint32_t pc = (uint32_t)-1;
+		uint32_t n = img.rowsize();
+		m_readback.resize( img.rows() * n );
+		uint32_t *got = m_readback.data();
+		for( uint32_t r = img.first(); r != Image::NOROW; r = img.next( r ), got += n ){
+			const uint32_t *want = img.row( r );
+			if( pc != n*r ) setPC( n*r );
+			for( uint32_t i = 0; i < n; i++ ){
+				write( Instructions::READNVM_INCPC );
+				hold( TDLY );
+				got[i] = read(PAYLOADSZ);
+				hold( TDLY );
+			}
+			pc = n*r + n;
+			defer( [&v, got, want, n, r]{
+				for( uint32_t i = 0; i < n; i++ ) v.word( n*r + i, got[i], want[i] );
+			} );
+		}
+		settle();
+		return v.passed();
+	}
+	bool verify( Verify& v ){
+		Image img;
+		link( img );
+		return verify( img, v );
+	}
+
+	/* True if the user IDs and config words already hold these values */
+	bool configMatches( const uint32_t *userid, const uint32_t *config ){
+		uint32_t ret[5];
+		readNVM( 0x8000, ret, 4 );
+		for( int i = 0; i < 4; i++ ){
+			if( ret[i] != userid[i] ) return false;
+		}
+		readNVM( 0x8007, ret, 5 );
+		for( int i = 0; i < 5; i++ ){
+			if( (ret[i] & config[i]) != config[i] ) return false;
+		}
+		return true;
+	}
+
+	/* Record a whole erase/program session (no verify) into s */
+	void compile( Session& s, const Image& img, uint32_t* userid, uint32_t* config ){
+
+		Recorder rec( s );
+		Transport* live = m_wire;
+		m_wire = &rec;
+		vppFirstEntry();
+		enterLVP();
+		setPC( 0x8000 );
+		bulkErase();
+		for( uint32_t r = img.first(); r != Image::NOROW; r = img.next( r ) ){
+			if( !img.blank( r ) ) loadRow( img.rowsize()*r, img.row( r ), img.rowsize() );
+		}
+		setPC( 0x8000 );
+		for( int i = 0; i < 4; i++ ){
+			writeNVM( userid[i] );
+			beginIntProgramming();
+			incPC();
+		}
+		setPC( 0x8007 );
+		for( int i = 0; i < 5; i++ ){
+			writeNVM( config[i] );
+			beginIntProgramming();
+			incPC();
+		}
+		vppFirstExit();
+		m_wire = live;
+	}
+	/* Record every command into t from now on */
+	void trace( Trace* t ){
+		m_trace = t;
+	}
+	/* Hand host work to p from now on */
+	void pipeline( Pipeline* p ){
+		m_pipe = p;
+	}
+	/* Run f on the pipeline if there is one, else right away */
+	void defer( const Pipeline::Task& f ){
+		if( m_pipe ) m_pipe->post( f );
+		else f();
+	}
+	/* Wait for deferred work */
+	void settle(){
+		if( m_pipe ) m_pipe->drain();
+	}
+	~Programmer(){
+		if( m_open ){
+			vppFirstExit();
+		}
+	}
+	void start(){
+		fprintf(stdout, "Starting up piC Programmer\n");
+		vppFirstEntry();
+		enterLVP();
+		uint16_t id = getDeviceID();
+		uint16_t rev = getRevisionID();
+		fprintf(stdout, "Device %04x rev. %04x found.\n", id, rev );
+		m_open = true;
+		/* Same part as last time: geometry and dwells still hold */
+		if( m_probed && id == m_devid && rev == m_revid ) return;
+		m_devid = id;
+		m_revid = rev;
+		m_probed = true;
+		getDCI();
+		printDCI(stdout);
+		m_dwell = SPEC_DWELL;
+		if( Profile::load( m_devid, m_revid, m_dwell ) ){
+			fprintf(stdout, "Using calibrated dwells for this part\n");
+			Profile::print( stdout, m_dwell );
+		}
+	}
+	uint16_t deviceID(){ return m_devid; }
+	uint16_t revisionID(){ return m_revid; }
+	const Dwell& dwell(){ return m_dwell; }
+	void setDwell( const Dwell& d ){ m_dwell = d; }
+
+	/* Find the shortest dwells that still verify on this part and add
+	 * guard percent. Each candidate must pass on DWELL_TRIALS rows; the
+	 * search bisects between zero and the spec value. Erases program
+	 * memory, leaves user IDs and config alone. */
+	Dwell calibrate( unsigned guard ){
+		Dwell d = SPEC_DWELL;
+		m_dwell = SPEC_DWELL;
+		d.pint = search( "TPINT", TPINT, guard, [&]( nsec_t t ){
+			blank();
+			for( uint32_t r = 0; r < DWELL_TRIALS; r++ ){
+				latchZeros( m_device.rowsize()*r );
+				write( Instructions::BEGININTPROGRAM );
+				hold( t );
+			}
+			return rowsAre( 0 );
+		} );
+		d.pext = search( "TPEXT", TPEXT, guard, [&]( nsec_t t ){
+			blank();
+			for( uint32_t r = 0; r < DWELL_TRIALS; r++ ){
+				latchZeros( m_device.rowsize()*r );
+				write( Instructions::BEGINEXTPROGRAM );
+				hold( t );
+				endExtProgramming();
+			}
+			return rowsAre( 0 );
+		} );
+		d.erar = search( "TERAR", TERAR, guard, [&]( nsec_t t ){
+			blank();
+			for( uint32_t r = 0; r < DWELL_TRIALS; r++ ){
+				latchZeros( m_device.rowsize()*r );
+				beginIntProgramming();
+				write( Instructions::ROWERASE );
+				hold( t );
+			}
+			return rowsAre( ERASED );
+		} );
+		d.erab = search( "TERAB", TERAB, guard, [&]( nsec_t t ){
+			blank();
+			for( uint32_t r = 0; r < DWELL_TRIALS; r++ ){
+				latchZeros( m_device.rowsize()*r );
+				beginIntProgramming();
+			}
+			setPC( 0 );
+			write( Instructions::BULKERASE );
+			hold( t );
+			return rowsAre( ERASED );
+		} );
+		blank();
+		m_dwell = d;
+		Profile::print( stdout, d );
+		return d;
+	}
+
+	void enterLVP(){
+
+		hold(TENTS);
+		edge( 0, LINE_MCLR );
+		hold(TENTH);
+
+		uint32_t bits = 0x4d434850;
+		write( bits, 32 );
+		hold(TENTH);
+	}
+
+	uint32_t readNVM(){
+		write( Instructions::READNVM );
+		hold(TDLY);
+		uint32_t ret = read( PAYLOADSZ );
+		hold(TDLY);
+		return ret;
+	}
+
+	int readNVM( uint32_t address, uint32_t* data, size_t len ){
+		setPC( address );
+		for( unsigned int i = 0; i < len; i++ ){
+			write( Instructions::READNVM_INCPC );
+			hold( TDLY );
+			data[i] = read(PAYLOADSZ);
+			hold( TDLY );
+		}
+		return len;
+	}
+
+	int writeNVM( uint32_t data ){
+		write( Instructions::LOADNVM );
+		hold( TDLY );
+		write( data << STOPBIT, PAYLOADSZ );
+		hold( TDLY );
+		return 1;
+	}
+
+	int writeNVM( uint32_t address, uint32_t* data, size_t len ){
+		setPC( address );
+		for( unsigned int i = 0; i < len; i++ ){
+			write( Instructions::LOADNVM_INCPC );
+			hold( TDLY );
+			write( data[i] << STOPBIT, PAYLOADSZ );
+			hold( TDLY );
+		}
+		return len;
+	}
+
+	void setPC(uint32_t address){
+		// OPCODE
+		write( Instructions::SETPC );
+		hold( TDLY );
+		/* Shift left because LSB is at bit 0 */
+		write( address << STOPBIT, PAYLOADSZ );
+		hold( TDLY );
+	}
+	void incPC(){
+		write( Instructions::INCPC );
+		hold( TDLY );
+	}
+
+	void bulkErase(){
+		write( Instructions::BULKERASE );
+		dwell( m_dwell.erab );
+	}
+
+	void rowErase(){
+		write( Instructions::ROWERASE );
+		dwell( m_dwell.erar );
+	}
+
+	void beginIntProgramming(){
+		write( Instructions::BEGININTPROGRAM );
+		dwell( m_dwell.pint );
+	}
+
+	void beginExtProgramming(){
+		write( Instructions::BEGINEXTPROGRAM);
+		dwell( m_dwell.pext );
+	}
+
+	void endExtProgramming(){
+		write( Instructions::ENDEXTPROGRAM );
+		hold( TDIS );
+	}
+
+	void setConfig( uint32_t *words ){
+		writeNVM( 0x8000, words, 4 );
+		beginIntProgramming();
+	}
+
+	/********* ROUND 2 *********/
+	bool writeRow( uint32_t address, const uint32_t *data, size_t sz ){
+		if( !loadRow( address, data, sz ) ) return false;
+		for( unsigned int i = 0; i < sz; i++ ){
+			write( Instructions::READNVM_INCPC );
+			hold( TDLY );
+			uint32_t ret = read(PAYLOADSZ);
+			Log::word( i, ret, data[i] );
+			if( ret != data[i] ) return false;
+			hold( TDLY );
+		}
+		return true;
+	}
+
+	/* Latch and program sz words, one programming cycle per write latch
+	 * load; loads that are all erased are skipped. Leaves the PC at
+	 * address */
+	bool loadRow( uint32_t address, const uint32_t *data, size_t sz ){
+		uint32_t latches = m_device.latches();
+		if( sz == 0 || sz > DEVICE_MAXROW || address % latches ){
+			fprintf(stderr, "Cannot program %zu words at %04x with %u latches\n", sz, address, latches);
+			return false;
+		}
+		uint32_t pc = (uint32_t)-1;
+		for( uint32_t at = 0; at < sz; at += latches ){
+			uint32_t n = sz - at < latches ? sz - at : latches;
+			bool blank = true;
+			for( uint32_t i = 0; i < n; i++ ){
+				if( data[at + i] != ERASED ) blank = false;
+			}
+			if( blank ) continue;
+			setPC( address + at );
+			for( uint32_t i = 0; i < n; i++ ){
+				write( Instructions::LOADNVM_INCPC );
+				hold( TDLY );
+				write( data[at + i] << STOPBIT, PAYLOADSZ );
+				hold( TDLY );
+			}
+			setPC( pc = address + at );
+			beginIntProgramming();
+		}
+		if( pc != address ) setPC( address );
+		return true;
+	}
+
+	uint16_t getDeviceID(){
+		setPC( 0x8006 );
+		return (uint16_t)readNVM();
+	}
+	uint16_t getRevisionID(){
+		setPC( 0x8005 );
+		return (uint16_t)(readNVM() & 0x0fff);
+	}
+
+	void getDIA(){
+		uint32_t ret[9];
+		readNVM( 0x8100, ret, 9 );
+		microid[9] = '\0';
+		for( int i = 0; i < 9; i++ ) microid[i] = ret[i];
+		readNVM( 0x810a, ret, 8 );
+		extuid[8] = '\0';
+		for( int i = 0; i < 8; i++ ) extuid[i] = ret[i];
+	}
+
+	/* Dump the whole part: program flash, user ID/IDs/config, DIA and any
+	 * data EEPROM, one SETPC + READNVM_INCPC burst per region. Erased
+	 * flash records are left out of the HEX. Returns words read */
+	uint32_t readout( HexWriter& hex ){
+		std::vector<uint32_t> buf( m_device.words() );
+		readNVM( 0, buf.data(), buf.size() );
+		hex.words( 0, buf.data(), buf.size(), true );
+		uint32_t n = buf.size();
+
+		uint32_t cfg[CONFIG + 5 - USERID];
+		readNVM( USERID, cfg, CONFIG + 5 - USERID );
+		hex.words( USERID, cfg, CONFIG + 5 - USERID );
+		n += CONFIG + 5 - USERID;
+
+		uint32_t dia[DIA_WORDS];
+		readNVM( DIA, dia, DIA_WORDS );
+		hex.words( DIA, dia, DIA_WORDS );
+		n += DIA_WORDS;
+
+		if( m_device.eeprom() ){
+			buf.resize( m_device.eeprom() );
+			readNVM( EEPROM, buf.data(), buf.size() );
+			hex.words( EEPROM, buf.data(), buf.size() );
+			n += buf.size();
+		}
+		hex.end();
+		return n;
+	}
+
+	void printDCI(FILE *fp){
+		m_device.print( fp );
+	}
+
+	/* Read the DCI and take the part's geometry from it */
+	void getDCI(){
+		uint32_t ret[5];
+		uint16_t dci[5];
+		readNVM( 0x8200, ret, 5 );
+		for( int i = 0; i < 5; i++ ) dci[i] = ret[i];
+		m_device.fromDCI( m_devid, dci );
+	}
+	const Device& device(){
+		return m_device;
+	}
+
+	void powerOn(){
+		m_wire->outputs();
+		edge( LINE_MCLR, 0 );
+		edge( LINE_POWER, 0 );
+	}
+
+	void stop(){
+		vppFirstExit();
+		m_wire->outputs();
+	}
+
+protected:
+	void write( uint32_t word, unsigned int numberofbits = 8 ){
+		if( m_trace ){
+			if( numberofbits == 8 ) m_trace->command( word );
+			else if( numberofbits != PAYLOADSZ ) m_trace->close();	//the entry key belongs to no command
+		}
+		m_wire->write( word, numberofbits );
+		if( m_trace ){
+			if( numberofbits == PAYLOADSZ ) m_trace->payload( word >> STOPBIT );
+			else if( numberofbits == 8 ) m_trace->wired();
+		}
+	}
+	uint32_t read( unsigned int numberofbits = 8){
+		uint32_t ret = m_wire->read( numberofbits );
+		//Ignore start and stop bit
+		ret &= ~(0x01 << (numberofbits - 1)); //mask (first) start bit
+		ret >>= 1; //shift over last (stop) bit
+		if( m_trace ) m_trace->payload( ret );
+		return ret;
+	}
+
+	void vppFirstEntry(){
+		m_wire->outputs();
+
+		edge( 0, LINE_ALL );
+
+		edge( LINE_MCLR, 0 );
+		hold(TENTS);
+		edge( LINE_POWER, 0 );
+		hold(TENTH);
+		edge( LINE_DATA | LINE_CLOCK, 0 );
+		hold(TCKH);
+		edge( 0, LINE_CLOCK );
+		hold(TCKL);
+
+		hold(10 * MSEC);
+	}
+	void vppFirstExit(){
+		m_open = false;
+		if( m_trace ) m_trace->close();
+		m_wire->outputs();
+
+		edge( 0, LINE_CLOCK );
+		hold(TCKL);
+		edge( LINE_CLOCK, 0 );
+		hold(TCKH);
+		edge( 0, LINE_CLOCK | LINE_DATA | LINE_POWER );
+		hold(TEXIT);
+		edge( 0, LINE_MCLR );
+	}
+	
+private:
+	uint16_t microid[10];
+	uint16_t extuid[9];
+	Device m_device;
+
+	Assembler m_asm;
+
+	bool m_open;
+
+	inline void edge( uint32_t set, uint32_t clr ){
+		m_wire->edge( set, clr );
+	}
+	inline void hold( nsec_t ns ){
+		m_wire->hold( ns );
+	}
+	/* A self-timed operation: the pipeline gets to run meanwhile */
+	inline void dwell( nsec_t ns ){
+		if( m_pipe ) m_pipe->kick();
+		m_wire->hold( ns );
+	}
+	/* Calibration helpers */
+	template<typename F>
+	nsec_t search( const char* name, nsec_t spec, unsigned guard, F pass ){
+		if( !pass( spec ) ){
+			fprintf(stderr, "%s: fails even at the spec value, keeping it\n", name);
+			return spec;
+		}
+		nsec_t lo = 0, hi = spec;
+		while( hi - lo > spec / DWELL_STEPS ){
+			nsec_t mid = ( lo + hi ) / 2;
+			if( pass( mid ) ) hi = mid;
+			else lo = mid;
+		}
+		nsec_t t = hi * ( 100 + guard ) / 100;
+		if( t > spec ) t = spec;
+		fprintf(stdout, "%s: verifies at %" PRIu64 " us, using %" PRIu64 " us (spec %" PRIu64 " us)\n",
+				name, hi / USEC, t / USEC, spec / USEC);
+		return t;
+	}
+	/* Program memory erased at the spec dwell */
+	void blank(){
+		setPC( 0 );
+		write( Instructions::BULKERASE );
+		hold( TERAB );
+	}
+	/* Fill one write latch load with zeros, every bit has to be programmed */
+	void latchZeros( uint32_t address ){
+		setPC( address );
+		for( uint32_t i = 0; i < m_device.latches(); i++ ){
+			write( Instructions::LOADNVM_INCPC );
+			hold( TDLY );
+			write( 0, PAYLOADSZ );
+			hold( TDLY );
+		}
+		setPC( address );
+	}
+	bool rowsAre( uint32_t value ){
+		uint32_t got[DEVICE_MAXROW];
+		for( uint32_t r = 0; r < DWELL_TRIALS; r++ ){
+			readNVM( m_device.rowsize()*r, got, m_device.latches() );
+			for( uint32_t i = 0; i < m_device.latches(); i++ ){
+				if( got[i] != value ) return false;
+			}
+		}
+		return true;
+	}
+
+	Transport* m_wire;
+	Trace* m_trace;
+	Pipeline* m_pipe;
+	std::vector<uint32_t> m_readback;	//verify's rows in flight
+	Dwell m_dwell;
+	uint16_t m_devid;
+	uint16_t m_revid;
+	bool m_probed;
+};
+
+#endif
@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#ifndef __REALTIME_HEADER__
+#define __REALTIME_HEADER__
+
+/*
+ * Opt-in real-time execution for the bit-bang loop.
+ *
+ * Locks all current and future pages, moves the process to SCHED_FIFO
+ * and optionally pins it to one CPU (ideally one removed from the
+ * scheduler with isolcpus=). The stack is prefaulted so the first deep
+ * call doesn't page fault mid-payload. Each step that fails is reported
+ * and skipped; the programmer still works, just without the guarantee.
+ */
+class Realtime{
+public:
+	static bool enter( int cpu = -1, int priority = 80 ){
+		bool ok = true;
+		if( mlockall( MCL_CURRENT | MCL_FUTURE ) < 0 ){
+			fprintf(stderr, "mlockall: %s\n", strerror(errno));
+			ok = false;
+		}
+		struct sched_param sp;
+		memset( &sp, 0, sizeof(sp) );
+		sp.sched_priority = priority;
+		if( sched_setscheduler( 0, SCHED_FIFO, &sp ) < 0 ){
+			fprintf(stderr, "SCHED_FIFO: %s\n", strerror(errno));
+			ok = false;
+		}
+		if( cpu >= 0 ){
+			cpu_set_t set;
+			CPU_ZERO( &set );
+			CPU_SET( cpu, &set );
+			if( sched_setaffinity( 0, sizeof(set), &set ) < 0 ){
+				fprintf(stderr, "CPU %d: %s\n", cpu, strerror(errno));
+				ok = false;
+			}
+		}
+		prefault();
+		if( ok ) fprintf(stdout, "Real-time mode: SCHED_FIFO %d, cpu %d\n", priority, cpu);
+		return ok;
+	}
+
+	/* For helper threads (log writer, pipeline, capture). A thread
+	 * started after enter() inherits SCHED_FIFO and would hold off the
+	 * wire thread it serves; this drops the calling thread back to
+	 * SCHED_OTHER. A no-op when enter() was never called. */
+	static void background(){
+		struct sched_param sp;
+		memset( &sp, 0, sizeof(sp) );
+		pthread_setschedparam( pthread_self(), SCHED_OTHER, &sp );
+	}
+private:
+	static void prefault(){
+		volatile unsigned char stack[256 * 1024];
+		for( size_t i = 0; i < sizeof(stack); i += 4096 ) stack[i] = 0;
+	}
+};
+
+#endif
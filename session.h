@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <vector>
+
+#include "pic.h"
+#include "timing.h"
+#include "transport.h"
+
+#ifndef __SESSION_HEADER__
+#define __SESSION_HEADER__
+
+/*
+ * A programming session flattened into GPIO stores.
+ *
+ * Each step is one GPIO_SET store, one GPIO_CLR store and the time the
+ * pins must then stay put. Programmer::compile() fills a Session by
+ * running the normal command sequence over a Recorder instead of a live
+ * transport; replay() then plays it back with nothing but stores and waits.
+ * Sessions are output only, readback happens live afterwards.
+ */
+class Session{
+public:
+	typedef struct step{
+		uint32_t set;
+		uint32_t clr;
+		nsec_t   hold;
+	}Step;
+
+	void edge( uint32_t set, uint32_t clr ){
+		/* Two stores with no hold between them collapse into one step */
+		if( !m_steps.empty() && m_steps.back().hold == 0 ){
+			Step& s = m_steps.back();
+			s.set = ( s.set & ~clr ) | set;
+			s.clr = ( s.clr & ~set ) | clr;
+			return;
+		}
+		Step s = { set, clr, 0 };
+		m_steps.push_back( s );
+	}
+	void hold( nsec_t ns ){
+		if( m_steps.empty() ){
+			Step s = { 0, 0, 0 };
+			m_steps.push_back( s );
+		}
+		m_steps.back().hold += ns;
+	}
+	void clear(){
+		m_steps.clear();
+	}
+
+	/* Caller owns pin directions; every pin in the session must be an output */
+	void replay() const{
+		const Step* s = m_steps.data();
+		const Step* end = s + m_steps.size();
+		for( ; s != end; s++ ){
+			GPIO_SET = s->set;
+			GPIO_CLR = s->clr;
+			Timing::wait( s->hold );
+		}
+	}
+
+	size_t size() const{
+		return m_steps.size();
+	}
+	nsec_t duration() const{
+		nsec_t t = 0;
+		for( size_t i = 0; i < m_steps.size(); i++ ) t += m_steps[i].hold;
+		return t;
+	}
+	void print( FILE* fp ) const{
+		fprintf(fp, "Session: %zu steps, %" PRIu64 " us on the wire\n",
+				size(), duration() / USEC );
+	}
+private:
+	std::vector<Step> m_steps;
+};
+
+/* A transport that only writes down what it would have driven */
+class Recorder final : public Transport{
+public:
+	Recorder( Session& s ){
+		m_session = &s;
+	}
+	inline void edge( uint32_t set, uint32_t clr ){
+		m_session->edge( set, clr );
+	}
+	inline void hold( nsec_t ns ){
+		m_session->hold( ns );
+	}
+	void write( uint32_t word, unsigned int numberofbits ){
+		shiftOut( *this, word, numberofbits );
+	}
+	uint32_t read( unsigned int ){
+		fprintf(stderr, "Cannot read back while compiling a session\n");
+		exit(EXIT_FAILURE);
+	}
+private:
+	Session* m_session;
+};
+
+#endif
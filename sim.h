@@ -0,0 +1,706 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "image.h"
+#include "assembler.h"
+
+#ifndef __SIM_HEADER__
+#define __SIM_HEADER__
+
+#define SIM_FOSC    32000000	//cycles are reported in us at this clock, Fosc/4 per cycle
+#define SIM_STACK   16		//hardware return stack levels
+#define SIM_BANKS   64		//MOVLB reaches 64 banks of 128 bytes
+#define SIM_PIRBANK 14		//PIR0-2 at 0x0c-0x0e, PIE0-2 at 0x16-0x18
+#define SIM_LOOPS   8		//hot loops reported
+#define SIM_ENTRY   3		//cycles of interrupt entry: the flushed fetch, then the vector call
+
+/*
+ * Host-side PIC16F152xx core for checking images before they are flashed.
+ *
+ * The image is decoded once into one Op per program word, so run() is a
+ * switch over a dense array. Data memory is 64 banks of 128 bytes with
+ * the core registers (INDF, PCL, STATUS, FSR, BSR, WREG, PCLATH, INTCON)
+ * in every bank, common RAM at 0x70-0x7f, FSR access to traditional,
+ * linear and program memory, PORTx reads built from LATx/TRISx with
+ * input pins low, and PIR0-2/PIE0-2 in bank 14. Interrupts take the shadow
+ * registers and vector to 4; interrupt(period) raises INTF every period
+ * cycles. Timers and peripherals beyond that are not modelled.
+ *
+ * Interrupt latency is measured per raise of INTF, from the cycle it is
+ * set to the first instruction of the handler: the instruction under way
+ * completes, then entry takes SIM_ENTRY cycles, which gives the
+ * datasheet's 3 cycles from an instruction boundary and 4 during a
+ * two-cycle instruction. The extra cycle an asynchronous source can take
+ * to synchronise is not modelled. Entries with no new raise behind them,
+ * such as a handler returning with INTF still set, are counted apart.
+ *
+ * Every word executed is counted with its cycles (2 for branches, taken
+ * skips and PCL writes), calls are timed from CALL to RETURN, and each
+ * backward branch times its iterations. report() folds this into per
+ * label self/inclusive cycles, the hottest loops and interrupt latency.
+ * Without labels from the assembler, CALL targets get sub_XXXX names.
+ */
+class Sim{
+public:
+	typedef enum{
+		LIMIT, ASLEEP, BLANK, ILLEGAL, OVERFLOW, UNDERFLOW, SOFTRESET
+	}Stop;
+
+	Sim( const Image& img ){
+		m_words = img.end();
+		m_flash.assign( MAXWORDS, ERASED );
+		m_code.resize( MAXWORDS );
+		for( uint32_t a = 0; a < MAXWORDS; a++ ){
+			bool present = a < m_words && img.present( a / img.rowsize() );
+			if( present ) m_flash[a] = img.get( a );
+			m_code[a] = decode( a, m_flash[a], present );
+		}
+		m_hits.assign( MAXWORDS, 0 );
+		m_cyc.assign( MAXWORDS, 0 );
+		m_calls.assign( MAXWORDS, 0 );
+		m_incl.assign( MAXWORDS, 0 );
+		for( uint32_t a = 0; a < MAXWORDS; a++ ){
+			Op& o = m_code[a];
+			if( o.op == CALL ) addLabel( ( a & 0x7800 ) | o.k, "sub" );
+		}
+		addLabel( 0, "reset" );
+		if( m_flash[4] != ERASED ) addLabel( 4, "interrupt" );
+		m_period = 0;
+		reset();
+	}
+
+	/* Name code by the assembler's labels instead of sub_XXXX */
+	void labels( const std::vector<Assembler::Symbol>& syms ){
+		m_labels.clear();
+		for( size_t i = 0; i < syms.size(); i++ ){
+			if( syms[i].defined ) m_labels.push_back( Label( syms[i].addr, syms[i].name ) );
+		}
+		if( m_labels.empty() || m_labels[0].first != 0 ) addLabel( 0, "reset" );
+		std::sort( m_labels.begin(), m_labels.end() );
+	}
+	/* Raise INTF every period cycles, 0 for never */
+	void interrupt( uint64_t period ){
+		m_period = period;
+		m_next = m_cycles + period;
+	}
+
+	void reset(){
+		memset( m_core, 0, sizeof(m_core) );
+		memset( m_ram, 0, sizeof(m_ram) );
+		memset( m_pins, 0, sizeof(m_pins) );
+		memset( m_shadow, 0, sizeof(m_shadow) );
+		for( int p = 0; p < 5; p++ ) m_ram[TRISA + p] = 0xff;
+		m_core[STATUS] = TO | PD;
+		m_pc = 0;
+		m_sp = 0;
+		m_cycles = 0;
+		m_executed = 0;
+		m_asleep = false;
+		m_raised = 0;
+		m_pending = false;
+		m_pclwrite = false;
+		m_raises = 0;
+		m_entries = 0;
+		m_measured = 0;
+		m_latmin = ~(uint64_t)0;
+		m_latmax = 0;
+		m_latsum = 0;
+		m_stop = LIMIT;
+		memset( m_toggles, 0, sizeof(m_toggles) );
+		if( m_period ) m_next = m_period;
+	}
+
+	/* Execute until limit more cycles have passed or the core stops */
+	Stop run( uint64_t limit ){
+		uint64_t end = m_cycles + limit;
+		while( m_cycles < end ){
+			if( m_period && m_cycles >= m_next ){
+				m_ram[PIR0] |= INTF;
+				if( !m_pending ) m_raised = m_next;
+				m_pending = true;
+				m_raises++;
+				m_next += m_period;
+			}
+			if( m_asleep ){
+				if( !pending() ){
+					if( !m_period ) return halt( ASLEEP );
+					m_cycles = std::min( std::max( m_cycles, m_next ), end );
+					continue;
+				}
+				m_asleep = false;
+			}
+			if( ( m_core[INTCON] & GIE ) && pending() ){
+				if( !enter() ) return m_stop;
+				continue;
+			}
+
+			uint32_t pc = m_pc;
+			const Op& o = m_code[pc];
+			m_pc = ( pc + 1 ) & 0x7fff;
+			unsigned cyc = 1;
+			uint8_t& w = m_core[WREG];
+			uint16_t fa = ( m_core[BSR] << 7 ) | o.k;	//direct file address
+			switch( o.op ){
+				case NOP: break;
+				case SOFTRESETOP: return halt( SOFTRESET );
+				case RETURN:
+					if( !pop() ) return m_stop;
+					cyc = 2;
+					break;
+				case RETFIE:
+					if( !pop() ) return m_stop;
+					memcpy( &m_core[STATUS], m_shadow, 1 );
+					w = m_shadow[1];
+					m_core[BSR] = m_shadow[2];
+					m_core[PCLATH] = m_shadow[3];
+					memcpy( &m_core[FSR0L], &m_shadow[4], 4 );
+					m_core[INTCON] |= GIE;
+					cyc = 2;
+					break;
+				case CALLW:
+					if( !push( m_pc, ( m_core[PCLATH] << 8 ) | w ) ) return m_stop;
+					m_pc = ( m_core[PCLATH] << 8 ) | w;
+					cyc = 2;
+					break;
+				case BRW:
+					m_pc = ( m_pc + w ) & 0x7fff;
+					cyc = 2;
+					break;
+				case MOVIWM: case MOVWIM:{
+					uint16_t& fsr = fsrOf( o.a & 1 );
+					int mm = o.a >> 1;
+					if( mm == 0 ) fsr++;
+					if( mm == 1 ) fsr--;
+					if( o.op == MOVIWM ){
+						w = loadFSR( fsr );
+						setZ( w );
+					}
+					else storeFSR( fsr, w );
+					if( mm == 2 ) fsr++;
+					if( mm == 3 ) fsr--;
+					putFSR( o.a & 1, fsr );
+					break;
+				}
+				case MOVLB: m_core[BSR] = o.k; break;
+				case SLEEPOP:
+					m_asleep = true;
+					m_core[STATUS] = ( m_core[STATUS] & ~PD ) | TO;
+					break;
+				case CLRWDT: m_core[STATUS] |= TO | PD; break;
+				case MOVWF: store( fa, w ); break;
+				case CLRW: w = 0; setZ( 0 ); break;
+				case CLRF: store( fa, 0 ); setZ( 0 ); break;
+				case SUBWF: dest( o, fa, add( load( fa ), ~w, 1 ) ); break;
+				case SUBWFB: dest( o, fa, add( load( fa ), ~w, m_core[STATUS] & C ) ); break;
+				case ADDWF: dest( o, fa, add( load( fa ), w, 0 ) ); break;
+				case ADDWFC: dest( o, fa, add( load( fa ), w, m_core[STATUS] & C ) ); break;
+				case DECF: dest( o, fa, setZ( load( fa ) - 1 ) ); break;
+				case INCF: dest( o, fa, setZ( load( fa ) + 1 ) ); break;
+				case IORWF: dest( o, fa, setZ( load( fa ) | w ) ); break;
+				case ANDWF: dest( o, fa, setZ( load( fa ) & w ) ); break;
+				case XORWF: dest( o, fa, setZ( load( fa ) ^ w ) ); break;
+				case MOVF: dest( o, fa, setZ( load( fa ) ) ); break;
+				case COMF: dest( o, fa, setZ( ~load( fa ) ) ); break;
+				case SWAPF:{
+					uint8_t v = load( fa );
+					dest( o, fa, ( v << 4 ) | ( v >> 4 ) );
+					break;
+				}
+				case RRF:{
+					uint8_t v = load( fa );
+					uint8_t r = ( v >> 1 ) | ( ( m_core[STATUS] & C ) << 7 );
+					setC( v & 1 );
+					dest( o, fa, r );
+					break;
+				}
+				case RLF:{
+					uint8_t v = load( fa );
+					uint8_t r = ( v << 1 ) | ( m_core[STATUS] & C );
+					setC( v & 0x80 );
+					dest( o, fa, r );
+					break;
+				}
+				case LSLF:{
+					uint8_t v = load( fa );
+					setC( v & 0x80 );
+					dest( o, fa, setZ( v << 1 ) );
+					break;
+				}
+				case LSRF:{
+					uint8_t v = load( fa );
+					setC( v & 1 );
+					dest( o, fa, setZ( v >> 1 ) );
+					break;
+				}
+				case ASRF:{
+					uint8_t v = load( fa );
+					setC( v & 1 );
+					dest( o, fa, setZ( ( v >> 1 ) | ( v & 0x80 ) ) );
+					break;
+				}
+				case DECFSZ: case INCFSZ:{
+					uint8_t r = load( fa ) + ( o.op == INCFSZ ? 1 : -1 );
+					dest( o, fa, r );
+					if( r == 0 ) cyc = skip();
+					break;
+				}
+				case BCF: store( fa, load( fa ) & ~( 1 << o.a ) ); break;
+				case BSF: store( fa, load( fa ) | ( 1 << o.a ) ); break;
+				case BTFSC: if( !( load( fa ) & ( 1 << o.a ) ) ) cyc = skip(); break;
+				case BTFSS: if( load( fa ) & ( 1 << o.a ) ) cyc = skip(); break;
+				case CALL:{
+					uint32_t to = ( ( m_core[PCLATH] & 0x78 ) << 8 ) | o.k;
+					if( !push( m_pc, to ) ) return m_stop;
+					m_pc = to;
+					cyc = 2;
+					break;
+				}
+				case GOTO:
+					m_pc = ( ( m_core[PCLATH] & 0x78 ) << 8 ) | o.k;
+					cyc = 2;
+					break;
+				case BRA:
+					m_pc = o.k;
+					cyc = 2;
+					break;
+				case MOVLW: w = o.k; break;
+				case MOVLP: m_core[PCLATH] = o.k; break;
+				case ADDFSR: putFSR( o.a, fsrOf( o.a ) + (int16_t)o.k ); break;
+				case RETLW:
+					w = o.k;
+					if( !pop() ) return m_stop;
+					cyc = 2;
+					break;
+				case IORLW: w = setZ( w | o.k ); break;
+				case ANDLW: w = setZ( w & o.k ); break;
+				case XORLW: w = setZ( w ^ o.k ); break;
+				case SUBLW: w = add( o.k, ~w, 1 ); break;
+				case ADDLW: w = add( w, o.k, 0 ); break;
+				case MOVIWK:
+					w = loadFSR( fsrOf( o.a ) + (int16_t)o.k );
+					setZ( w );
+					break;
+				case MOVWIK: storeFSR( fsrOf( o.a ) + (int16_t)o.k, w ); break;
+				case BLANKOP:
+					m_pc = pc;
+					return halt( BLANK );
+				default:
+					m_pc = pc;
+					return halt( ILLEGAL );
+			}
+			if( m_pclwrite ){
+				m_pclwrite = false;
+				cyc = 2;
+			}
+			if( o.loop != NOLOOP && m_pc == m_loops[o.loop].top ) lap( o.loop );
+			m_hits[pc]++;
+			m_cyc[pc] += cyc;
+			m_cycles += cyc;
+			m_executed++;
+		}
+		return halt( LIMIT );
+	}
+
+	uint64_t cycles() const{ return m_cycles; }
+	uint32_t pc() const{ return m_pc; }
+	uint8_t wreg() const{ return m_core[WREG]; }
+
+	void report( FILE* fp ) const{
+		static const char* why[] = { "cycle limit", "asleep, no interrupt to wake it",
+			"ran into unprogrammed flash", "illegal opcode", "stack overflow", "stack underflow",
+			"RESET instruction" };
+		fprintf(fp, "Sim: %" PRIu64 " cycles (%.1f us at %u MHz), %" PRIu64 " instructions, stopped at %04x: %s\n",
+				m_cycles, m_cycles * 4e6 / SIM_FOSC, SIM_FOSC / 1000000, m_executed, m_pc, why[m_stop]);
+
+		/* Self cycles per label region, inclusive per call */
+		fprintf(fp, "  %-22s %5s %8s %10s %6s %10s\n", "label", "addr", "calls", "self", "%", "incl/call");
+		for( size_t i = 0; i < m_labels.size(); i++ ){
+			uint32_t from = m_labels[i].first;
+			uint32_t to = i + 1 < m_labels.size() ? m_labels[i + 1].first : MAXWORDS;
+			uint64_t self = 0;
+			for( uint32_t a = from; a < to; a++ ) self += m_cyc[a];
+			uint64_t calls = m_calls[from];
+			if( self == 0 && calls == 0 ) continue;
+			fprintf(fp, "  %-22s %04x %8" PRIu64 " %10" PRIu64 " %5.1f%%", m_labels[i].second.c_str(),
+					from, calls, self, m_cycles ? 100.0 * self / m_cycles : 0.0);
+			if( calls ) fprintf(fp, " %10.1f", (double)m_incl[from] / calls);
+			fprintf(fp, "\n");
+		}
+
+		/* Loops by the cycles they took, each iteration timed end to end */
+		std::vector<size_t> order;
+		for( size_t i = 0; i < m_loops.size(); i++ ){
+			if( m_loops[i].laps ) order.push_back( i );
+		}
+		std::sort( order.begin(), order.end(), [this]( size_t a, size_t b ){
+			return m_loops[a].sum > m_loops[b].sum;
+		} );
+		if( !order.empty() ) fprintf(fp, "  Hot loops:\n");
+		for( size_t k = 0; k < order.size() && k < SIM_LOOPS; k++ ){
+			const Loop& l = m_loops[order[k]];
+			fprintf(fp, "    %-20s %04x-%04x %8" PRIu64 " laps, %" PRIu64 "-%" PRIu64 " cycles, mean %.1f\n",
+					where( l.top ).c_str(), l.top, l.branch, l.laps, l.min, l.max, (double)l.sum / l.laps);
+		}
+
+		if( m_raises || m_entries ){
+			fprintf(fp, "  Interrupts: %" PRIu64 " raised, %" PRIu64 " taken", m_raises, m_entries);
+			if( m_measured ) fprintf(fp, ", latency %" PRIu64 "-%" PRIu64 " cycles, mean %.1f",
+					m_latmin, m_latmax, (double)m_latsum / m_measured);
+			if( m_entries > m_measured ) fprintf(fp, ", %" PRIu64 " with no new raise", m_entries - m_measured);
+			fprintf(fp, "\n");
+		}
+		for( int p = 0; p < 5; p++ ){
+			uint64_t n = 0;
+			for( int b = 0; b < 8; b++ ) n += m_toggles[p][b];
+			if( n == 0 ) continue;
+			fprintf(fp, "  LAT%c %02x, TRIS%c %02x, changes:", 'A' + p, m_ram[LATA + p], 'A' + p, m_ram[TRISA + p]);
+			for( int b = 0; b < 8; b++ ){
+				if( m_toggles[p][b] ) fprintf(fp, " R%c%d %" PRIu64, 'A' + p, b, m_toggles[p][b]);
+			}
+			fprintf(fp, "\n");
+		}
+	}
+
+private:
+	typedef enum{
+		NOP, SOFTRESETOP, RETURN, RETFIE, CALLW, BRW, MOVIWM, MOVWIM, MOVLB, SLEEPOP, CLRWDT,
+		MOVWF, CLRW, CLRF, SUBWF, DECF, IORWF, ANDWF, XORWF, ADDWF, MOVF, COMF, INCF, DECFSZ,
+		RRF, RLF, SWAPF, INCFSZ, BCF, BSF, BTFSC, BTFSS, CALL, GOTO, MOVLW, ADDFSR, MOVLP, BRA,
+		RETLW, LSLF, LSRF, ASRF, IORLW, ANDLW, XORLW, SUBWFB, SUBLW, ADDWFC, ADDLW, MOVIWK, MOVWIK,
+		ILLEGALOP, BLANKOP
+	}Code;
+	/* One predecoded word: k is the file address, literal, absolute BRA
+	 * target or signed offset; a the d bit, bit number or FSR (+ mode) */
+	typedef struct op{
+		uint8_t  op;
+		uint8_t  a;
+		uint16_t k;
+		uint16_t loop;	//index into m_loops for backward branches
+	}Op;
+	typedef struct loop{
+		uint32_t top, branch;
+		uint64_t laps, min, max, sum, last;
+	}Loop;
+	typedef struct frame{
+		uint16_t callee;
+		uint64_t at;
+	}Frame;
+	typedef std::pair<uint32_t, std::string> Label;
+
+	static const uint16_t NOLOOP = 0xffff;
+	/* Core registers, in every bank */
+	enum{ INDF0, INDF1, PCL, STATUS, FSR0L, FSR0H, FSR1L, FSR1H, BSR, WREG, PCLATH, INTCON, CORE };
+	enum{ C = 1, DC = 2, Z = 4, PD = 8, TO = 16 };	//STATUS
+	enum{ GIE = 0x80, PEIE = 0x40 };		//INTCON
+	enum{ INTF = 1 };				//PIR0
+	enum{ PORTA = 0x0c, TRISA = 0x12, LATA = 0x18,
+		PIR0 = ( SIM_PIRBANK << 7 ) | 0x0c, PIE0 = ( SIM_PIRBANK << 7 ) | 0x16 };
+
+	Op decode( uint32_t pc, uint32_t w, bool present ){
+		Op o = { ILLEGALOP, 0, 0, NOLOOP };
+		if( !present ){
+			o.op = BLANKOP;
+			return o;
+		}
+		static const uint8_t byteops[16] = { 0, 0, SUBWF, DECF, IORWF, ANDWF, XORWF, ADDWF,
+			MOVF, COMF, INCF, DECFSZ, RRF, RLF, SWAPF, INCFSZ };
+		static const uint8_t litops[16] = { MOVLW, 0, BRA, BRA, RETLW, LSLF, LSRF, ASRF,
+			IORLW, ANDLW, XORLW, SUBWFB, SUBLW, ADDWFC, ADDLW, 0 };
+		uint32_t hi = ( w >> 8 ) & 0xf;
+		o.k = w & 0x7f;
+		o.a = ( w >> 7 ) & 1;
+		switch( w >> 12 ){
+			case 0:
+				if( hi == 0 ){
+					if( w & 0x80 ) o.op = MOVWF;
+					else if( w == 0x00 ) o.op = NOP;
+					else if( w == 0x01 ) o.op = SOFTRESETOP;
+					else if( w >= 0x08 && w <= 0x0b ) o.op = RETURN + ( w - 0x08 );
+					else if( w >= 0x10 && w <= 0x1f ){
+						o.op = w & 0x08 ? MOVWIM : MOVIWM;
+						o.a = ( ( w >> 2 ) & 1 ) | ( ( w & 3 ) << 1 );
+					}
+					else if( w == 0x63 ) o.op = SLEEPOP;
+					else if( w == 0x64 ) o.op = CLRWDT;
+				}
+				else if( hi == 1 ){
+					if( w & 0x80 ) o.op = CLRF;
+					else if( w & 0x40 ){
+						o.op = MOVLB;
+						o.k = w & 0x3f;
+					}
+					else if( ( w & 0x7c ) == 0 ) o.op = CLRW;
+				}
+				else o.op = byteops[hi];
+				break;
+			case 1:
+				o.op = BCF + ( ( w >> 10 ) & 3 );
+				o.a = ( w >> 7 ) & 7;
+				break;
+			case 2:
+				o.op = w & 0x800 ? GOTO : CALL;
+				o.k = w & 0x7ff;
+				if( o.op == GOTO && ( ( pc & 0x7800 ) | o.k ) <= pc ) o.loop = newLoop( ( pc & 0x7800 ) | o.k, pc );
+				break;
+			case 3:
+				if( hi == 1 ){
+					if( w & 0x80 ){
+						o.op = MOVLP;
+						o.k = w & 0x7f;
+					}
+					else{
+						o.op = ADDFSR;
+						o.a = ( w >> 6 ) & 1;
+						o.k = (uint16_t)sext( w & 0x3f, 6 );
+					}
+				}
+				else if( hi == 15 ){
+					o.op = w & 0x80 ? MOVWIK : MOVIWK;
+					o.a = ( w >> 6 ) & 1;
+					o.k = (uint16_t)sext( w & 0x3f, 6 );
+				}
+				else if( litops[hi] == BRA ){
+					o.op = BRA;
+					o.k = ( pc + 1 + sext( w & 0x1ff, 9 ) ) & 0x7fff;
+					if( o.k <= pc ) o.loop = newLoop( o.k, pc );
+				}
+				else{
+					o.op = litops[hi];
+					if( o.op == LSLF || o.op == LSRF || o.op == ASRF || o.op == SUBWFB || o.op == ADDWFC ){
+						o.k = w & 0x7f;
+						o.a = ( w >> 7 ) & 1;
+					}
+					else o.k = w & 0xff;
+				}
+				break;
+		}
+		return o;
+	}
+	static int32_t sext( uint32_t v, int bits ){
+		return ( v & ( 1u << (bits - 1) ) ) ? (int32_t)v - ( 1 << bits ) : (int32_t)v;
+	}
+	uint16_t newLoop( uint32_t top, uint32_t branch ){
+		Loop l = { top, branch, 0, ~(uint64_t)0, 0, 0, 0 };
+		m_loops.push_back( l );
+		return m_loops.size() - 1;
+	}
+	void addLabel( uint32_t addr, const char* prefix ){
+		for( size_t i = 0; i < m_labels.size(); i++ ){
+			if( m_labels[i].first == addr ) return;
+		}
+		char name[32];
+		if( addr == 0 || addr == 4 ) snprintf( name, sizeof(name), "%s", prefix );
+		else snprintf( name, sizeof(name), "%s_%04x", prefix, addr );
+		m_labels.insert( std::upper_bound( m_labels.begin(), m_labels.end(), Label( addr, "" ) ),
+				Label( addr, name ) );
+	}
+	/* Label+offset of an address */
+	std::string where( uint32_t addr ) const{
+		std::vector<Label>::const_iterator it = std::upper_bound( m_labels.begin(), m_labels.end(),
+				Label( addr, "\xff" ) );
+		if( it == m_labels.begin() ) return "";
+		--it;
+		char off[16];
+		snprintf( off, sizeof(off), "+%u", addr - it->first );
+		return addr == it->first ? it->second : it->second + off;
+	}
+
+	void lap( uint16_t i ){
+		Loop& l = m_loops[i];
+		uint64_t now = m_cycles + 2;
+		if( l.last ){
+			uint64_t t = now - l.last;
+			l.laps++;
+			l.sum += t;
+			if( t < l.min ) l.min = t;
+			if( t > l.max ) l.max = t;
+		}
+		l.last = now;
+	}
+	unsigned skip(){
+		m_pc = ( m_pc + 1 ) & 0x7fff;
+		return 2;
+	}
+	Stop halt( Stop why ){
+		m_stop = why;
+		return why;
+	}
+
+	bool push( uint32_t ret, uint32_t callee ){
+		if( m_sp == SIM_STACK ) return halt( OVERFLOW ) == LIMIT;
+		m_ret[m_sp] = ret;
+		m_frame[m_sp].callee = callee;
+		m_frame[m_sp].at = m_cycles + 2;
+		m_sp++;
+		m_calls[callee]++;
+		return true;
+	}
+	bool pop(){
+		if( m_sp == 0 ) return halt( UNDERFLOW ) == LIMIT;
+		m_sp--;
+		m_pc = m_ret[m_sp];
+		m_incl[m_frame[m_sp].callee] += m_cycles + 2 - m_frame[m_sp].at;
+		return true;
+	}
+	bool pending() const{
+		const uint8_t* pir = &m_ram[PIR0];
+		const uint8_t* pie = &m_ram[PIE0];
+		if( pir[0] & pie[0] ) return true;
+		return ( m_core[INTCON] & PEIE ) && ( ( pir[1] & pie[1] ) || ( pir[2] & pie[2] ) );
+	}
+	/* Interrupt entry: shadow the context, push the PC, vector to 4 */
+	bool enter(){
+		m_shadow[0] = m_core[STATUS];
+		m_shadow[1] = m_core[WREG];
+		m_shadow[2] = m_core[BSR];
+		m_shadow[3] = m_core[PCLATH];
+		memcpy( &m_shadow[4], &m_core[FSR0L], 4 );
+		if( !push( m_pc, 4 ) ) return false;
+		m_core[INTCON] &= ~GIE;
+		m_pc = 4;
+		m_cycles += SIM_ENTRY;
+		m_frame[m_sp - 1].at = m_cycles;
+		m_entries++;
+		if( m_pending ){
+			uint64_t lat = m_cycles - m_raised;
+			m_measured++;
+			m_latsum += lat;
+			if( lat < m_latmin ) m_latmin = lat;
+			if( lat > m_latmax ) m_latmax = lat;
+			m_pending = false;
+		}
+		return true;
+	}
+
+	uint8_t setZ( uint8_t v ){
+		m_core[STATUS] = ( m_core[STATUS] & ~Z ) | ( v ? 0 : Z );
+		return v;
+	}
+	void setC( bool c ){
+		m_core[STATUS] = ( m_core[STATUS] & ~C ) | ( c ? C : 0 );
+	}
+	/* a + b + cin with C, DC and Z; subtraction is a + ~b + 1, C = no borrow */
+	uint8_t add( uint8_t a, uint8_t b, unsigned cin ){
+		unsigned r = a + b + cin;
+		bool dc = ( ( a & 0xf ) + ( b & 0xf ) + cin ) > 0xf;
+		m_core[STATUS] = ( m_core[STATUS] & ~( C | DC ) ) | ( r > 0xff ? C : 0 ) | ( dc ? DC : 0 );
+		return setZ( r & 0xff );
+	}
+	void dest( const Op& o, uint16_t fa, uint8_t v ){
+		if( o.a ) store( fa, v );
+		else m_core[WREG] = v;
+	}
+
+	uint16_t& fsrOf( int n ){
+		m_fsr[n] = m_core[FSR0L + 2*n] | ( m_core[FSR0H + 2*n] << 8 );
+		return m_fsr[n];
+	}
+	void putFSR( int n, uint16_t v ){
+		m_core[FSR0L + 2*n] = v & 0xff;
+		m_core[FSR0H + 2*n] = v >> 8;
+	}
+
+	/* Traditional data address: bank << 7 | offset */
+	uint8_t load( uint16_t a ){
+		uint8_t off = a & 0x7f;
+		if( off < CORE ){
+			if( off == INDF0 || off == INDF1 ) return loadFSR( fsrOf( off ) );
+			if( off == PCL ) return m_pc & 0xff;
+			return m_core[off];
+		}
+		if( off >= 0x70 ) a = off;
+		if( a >= PORTA && a < PORTA + 5 ){
+			int p = a - PORTA;
+			uint8_t tris = m_ram[TRISA + p];
+			return ( m_ram[LATA + p] & ~tris ) | ( m_pins[p] & tris );
+		}
+		return m_ram[a & ( SIM_BANKS * 128 - 1 )];
+	}
+	void store( uint16_t a, uint8_t v ){
+		uint8_t off = a & 0x7f;
+		if( off < CORE ){
+			switch( off ){
+				case INDF0: case INDF1: storeFSR( fsrOf( off ), v ); break;
+				case PCL:
+					m_pc = ( m_core[PCLATH] << 8 ) | v;
+					m_pclwrite = true;
+					break;
+				case STATUS: m_core[STATUS] = ( m_core[STATUS] & ~( C | DC | Z ) ) | ( v & ( C | DC | Z ) ); break;
+				case BSR: m_core[BSR] = v & 0x3f; break;
+				case PCLATH: m_core[PCLATH] = v & 0x7f; break;
+				default: m_core[off] = v; break;
+			}
+			return;
+		}
+		if( off >= 0x70 ) a = off;
+		if( a >= PORTA && a < PORTA + 5 ) a += LATA - PORTA;	//writing a port writes its latch
+		if( a >= LATA && a < LATA + 5 ){
+			uint8_t changed = m_ram[a] ^ v;
+			for( int b = 0; b < 8; b++ ){
+				if( changed & ( 1 << b ) ) m_toggles[a - LATA][b]++;
+			}
+		}
+		m_ram[a & ( SIM_BANKS * 128 - 1 )] = v;
+	}
+	/* FSR space: 0x0000-0x0fff traditional, 0x2000 linear GPR (80 bytes
+	 * per bank), 0x8000 up program flash low bytes */
+	uint8_t loadFSR( uint16_t a ){
+		if( a & 0x8000 ) return m_flash[a & 0x7fff] & 0xff;
+		if( a >= 0x2000 && a < 0x2000 + 80 * SIM_BANKS ){
+			uint16_t n = a - 0x2000;
+			return load( ( ( n / 80 ) << 7 ) | ( 0x20 + n % 80 ) );
+		}
+		if( a < 0x1000 && ( a & 0x7f ) > INDF1 ) return load( a );
+		return 0;
+	}
+	void storeFSR( uint16_t a, uint8_t v ){
+		if( a & 0x8000 ) return;	//flash is written over NVMCON, not modelled
+		if( a >= 0x2000 && a < 0x2000 + 80 * SIM_BANKS ){
+			uint16_t n = a - 0x2000;
+			store( ( ( n / 80 ) << 7 ) | ( 0x20 + n % 80 ), v );
+		}
+		else if( a < 0x1000 && ( a & 0x7f ) > INDF1 ) store( a, v );
+	}
+
+	uint32_t m_words;
+	std::vector<uint32_t> m_flash;
+	std::vector<Op> m_code;
+	std::vector<Loop> m_loops;
+	std::vector<Label> m_labels;
+	std::vector<uint64_t> m_hits;	//executions per word
+	std::vector<uint64_t> m_cyc;	//cycles per word
+	std::vector<uint64_t> m_calls;	//calls (and interrupts) per target
+	std::vector<uint64_t> m_incl;	//cycles from call to return per target
+
+	uint8_t m_core[CORE];
+	uint8_t m_ram[SIM_BANKS * 128];
+	uint8_t m_pins[5];
+	uint8_t m_shadow[8];
+	uint16_t m_fsr[2];
+	uint32_t m_ret[SIM_STACK];
+	Frame m_frame[SIM_STACK];
+	unsigned m_sp;
+	uint32_t m_pc;
+	bool m_pclwrite;
+	bool m_asleep;
+
+	uint64_t m_cycles;
+	uint64_t m_executed;
+	uint64_t m_period;
+	uint64_t m_next;
+	uint64_t m_raised;
+	bool m_pending;
+	uint64_t m_raises;
+	uint64_t m_entries;
+	uint64_t m_measured;	//entries that answered a raise, the latency sample
+	uint64_t m_latmin, m_latmax, m_latsum;
+	uint64_t m_toggles[5][8];
+	Stop m_stop;
+};
+const uint16_t Sim::NOLOOP;
+
+#endif
@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <vector>
+#include <sys/ioctl.h>
+#include <linux/spi/spidev.h>
+
+#include "pic.h"
+#include "timing.h"
+#include "transport.h"
+
+#ifndef __SPI_HEADER__
+#define __SPI_HEADER__
+
+#define SPI_DEVICE  "/dev/spidev0.0"
+#define SPI_HZ      4000000	//TCKH/TCKL >= 100ns allows 5MHz
+#define SPI_QUEUE   256		//transfers per SPI_IOC_MESSAGE
+#define SPI_MAXHOLD (1 * MSEC)	//longer holds flush and wait instead
+#define SPI_MAXDELAY 0xffff	//delay_usecs is 16 bits
+
+/* Something that can run a batch of spidev transfers as one message and
+ * owns the clock/data pin functions while it does */
+class SPIBus{
+public:
+	virtual ~SPIBus(){
+	}
+	virtual bool transfer( struct spi_ioc_transfer* xfers, unsigned n ) = 0;
+	/* Hand clock/data to the controller (true) or back to GPIO as driven
+	 * outputs, clock low (false) */
+	virtual void mux( bool spi ) = 0;
+};
+
+/* The real controller behind /dev/spidev */
+class Spidev : public SPIBus{
+public:
+	Spidev( const char* device = SPI_DEVICE, uint32_t hz = SPI_HZ ){
+		if( (m_fd = open( device, O_RDWR )) < 0 ){
+			fprintf(stderr, "%s: %s\n", device, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		/* LVP: host changes data on the rising edge, target latches on
+		 * the falling edge, clock idles low -> mode 1, MSB first */
+		uint8_t mode = SPI_MODE_1;
+		uint8_t bits = 8;
+		if( ioctl( m_fd, SPI_IOC_WR_MODE, &mode ) < 0 ||
+				ioctl( m_fd, SPI_IOC_WR_BITS_PER_WORD, &bits ) < 0 ||
+				ioctl( m_fd, SPI_IOC_WR_MAX_SPEED_HZ, &hz ) < 0 ){
+			fprintf(stderr, "%s: cannot configure: %s\n", device, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+	~Spidev(){
+		close( m_fd );
+	}
+	bool transfer( struct spi_ioc_transfer* xfers, unsigned n ){
+		unsigned long req = _IOC( _IOC_WRITE, SPI_IOC_MAGIC, 0, n * sizeof(struct spi_ioc_transfer) );
+		return ioctl( m_fd, req, xfers ) >= 0;
+	}
+	void mux( bool spi ){
+		if( spi ){
+			Pin::setFunction( GPIO_CLOCK, Pin::FSEL_ALT0 );
+			Pin::setFunction( GPIO_DATA, Pin::FSEL_ALT0 );
+			return;
+		}
+		Pin::drive( 0, LINE_CLOCK );
+		Pin::setFunction( GPIO_CLOCK, Pin::FSEL_OUTPUT );
+		Pin::setFunction( GPIO_DATA, Pin::FSEL_OUTPUT );
+	}
+private:
+	int m_fd;
+};
+
+/* Stand-in bus that records every transfer instead of clocking it out */
+class RecordingSPIBus : public SPIBus{
+public:
+	typedef struct record{
+		std::vector<uint8_t> bytes;
+		uint32_t delay;	//us after the transfer
+		unsigned message;	//which SPI_IOC_MESSAGE it went out in
+	}Record;
+
+	RecordingSPIBus(){
+		messages = 0;
+		muxed = false;
+	}
+	bool transfer( struct spi_ioc_transfer* xfers, unsigned n ){
+		for( unsigned i = 0; i < n; i++ ){
+			const uint8_t* tx = (const uint8_t*)(uintptr_t)xfers[i].tx_buf;
+			Record r;
+			r.bytes.assign( tx, tx + xfers[i].len );
+			r.delay = xfers[i].delay_usecs;
+			r.message = messages;
+			log.push_back( r );
+		}
+		messages++;
+		return true;
+	}
+	void mux( bool spi ){
+		muxed = spi;
+	}
+	void print( FILE* fp ){
+		for( size_t i = 0; i < log.size(); i++ ){
+			fprintf(fp, "[%u]", log[i].message);
+			for( size_t j = 0; j < log[i].bytes.size(); j++ ) fprintf(fp, " %02x", log[i].bytes[j]);
+			fprintf(fp, " +%uus\n", log[i].delay);
+		}
+	}
+
+	std::vector<Record> log;
+	unsigned messages;
+	bool muxed;	//clock/data currently belong to the controller
+};
+
+/*
+ * ICSP commands and payloads shifted by the SPI controller.
+ *
+ * Each write() becomes one queued transfer (1 byte command, 3 byte
+ * payload, 4 byte entry key). Short holds ride along as the transfer's
+ * delay_usecs, so a whole row load goes out in a single ioctl; holds of
+ * SPI_MAXHOLD or more, or that would overflow delay_usecs, flush the
+ * queue and wait on the host.
+ *
+ * The clock and data pins are switched to ALT0 (SPI0 SCLK/MOSI) by the
+ * bus while the controller owns them. Readback and MCLR/power sequencing
+ * stay on the GPIO transport: the queue is flushed before any edge, and clock/data
+ * are handed back as GPIO outputs before they are driven by hand.
+ */
+class SPITransport final : public Transport{
+public:
+	SPITransport( SPIBus& bus, Transport& gpio, uint32_t hz = SPI_HZ ){
+		m_bus = &bus;
+		m_gpio = &gpio;
+		m_hz = hz;
+		m_n = 0;
+		m_claimed = false;
+		m_messages = 0;
+		m_transfers = 0;
+		/* Opening spidev may have claimed our pins, take them back */
+		m_gpio->invalidate();
+		m_gpio->outputs();
+	}
+	~SPITransport(){
+		release();
+	}
+
+	void edge( uint32_t set, uint32_t clr ){
+		if( (set | clr) & (LINE_CLOCK | LINE_DATA) ) release();
+		else flush();
+		m_gpio->edge( set, clr );
+	}
+	void write( uint32_t word, unsigned int numberofbits ){
+		if( numberofbits % 8 || numberofbits > 32 ){
+			fprintf(stderr, "SPI cannot shift %u bits\n", numberofbits);
+			exit(EXIT_FAILURE);
+		}
+		claim();
+		if( m_n == SPI_QUEUE ) flush();
+		struct spi_ioc_transfer& x = m_xfer[m_n];
+		uint8_t* buf = m_buf[m_n];
+		unsigned len = numberofbits / 8;
+		for( unsigned i = 0; i < len; i++ ){
+			buf[i] = word >> ( 8 * (len - 1 - i) );
+		}
+		memset( &x, 0, sizeof(x) );
+		x.tx_buf = (uintptr_t)buf;
+		x.len = len;
+		x.speed_hz = m_hz;
+		x.bits_per_word = 8;
+		m_n++;
+	}
+	uint32_t read( unsigned int numberofbits ){
+		release();
+		return m_gpio->read( numberofbits );
+	}
+	void hold( nsec_t ns ){
+		uint32_t us = ( ns + USEC - 1 ) / USEC;
+		if( m_n > 0 && ns < SPI_MAXHOLD && m_xfer[m_n - 1].delay_usecs + us <= SPI_MAXDELAY ){
+			m_xfer[m_n - 1].delay_usecs += us;
+			return;
+		}
+		flush();
+		Timing::wait( ns );
+	}
+	void outputs(){
+		release();
+		m_gpio->outputs();
+	}
+	void flush(){
+		if( m_n == 0 ) return;
+		if( !m_bus->transfer( m_xfer, m_n ) ){
+			fprintf(stderr, "SPI transfer failed: %s\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		m_messages++;
+		m_transfers += m_n;
+		m_n = 0;
+	}
+	/* Flush and give clock/data back to GPIO as outputs */
+	void release(){
+		flush();
+		if( !m_claimed ) return;
+		m_bus->mux( false );
+		m_gpio->invalidate();
+		m_claimed = false;
+	}
+	bool claimed(){ return m_claimed; }
+
+	void print( FILE* fp ){
+		fprintf(fp, "SPI: %u transfers in %u messages\n", m_transfers, m_messages);
+	}
+private:
+	void claim(){
+		if( m_claimed ) return;
+		m_bus->mux( true );
+		m_claimed = true;
+	}
+
+	SPIBus* m_bus;
+	Transport* m_gpio;
+	uint32_t m_hz;
+	struct spi_ioc_transfer m_xfer[SPI_QUEUE];
+	uint8_t m_buf[SPI_QUEUE][4];
+	unsigned m_n;
+	bool m_claimed;
+	unsigned m_messages;
+	unsigned m_transfers;
+};
+
+#endif
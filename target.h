@@ -0,0 +1,355 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <vector>
+
+#include "timing.h"
+#include "transport.h"
+#include "instructions.h"
+#include "image.h"
+
+#ifndef __TARGET_HEADER__
+#define __TARGET_HEADER__
+
+#define TARGET_DEVID  0x30ed	//PIC16F15256
+#define TARGET_REVID  0x2002	//revision A2
+#define TARGET_WORDS  0x4000	//16K words of program flash
+#define TARGET_ROW    32	//erase row size and write latches
+#define TARGET_PINS   28
+#define TARGET_KEY    0x4d434850	//"MCHP"
+#define TARGET_REPORT 16	//violations kept with details
+#define TARGET_SPEED  75	//actual dwells, percent of spec
+
+/*
+ * An emulated PIC16F152xx on the far end of the wire.
+ *
+ * Decodes ICSP at the word level: 8-bit commands, 24-bit payloads (start
+ * bit, 14/16 data bits, stop bit) and the 32-bit entry key, gated by the
+ * MCLR and power lines from edge(). It keeps program flash, user IDs,
+ * config words, the read-only revision/device ID, DIA and DCI, and models
+ * the write latches: LOADNVM fills the latch PC selects, BEGININTPROGRAM
+ * and BEGINEXTPROGRAM can only clear bits of the words the latches cover
+ * and then reset them to erased. Erase row and latch count are
+ * constructor arguments, reported through the DCI.
+ *
+ * Time is virtual: hold() advances it and each shifted bit costs
+ * TCKH + TCKL, so nothing here sleeps. Every gap is checked against the
+ * spec (TENTH before the key and the first command, TDLY around
+ * payloads, TERAB/TERAR/TPINT/TPEXT/TDIS after a busy command) and
+ * reported as a violation. Separately, a busy command only takes effect
+ * if it was given at least the part's actual dwell (setDwell(), by
+ * default TARGET_SPEED percent of the spec maximum, as real parts beat
+ * it), so a programmer cutting dwells short is caught by its own verify.
+ */
+class Target final : public Transport{
+public:
+	typedef enum{
+		IDLE = 0, BULK, ROW, PROGRAM, EXTPROGRAM, ENDEXT, BUSYCOUNT
+	}Busy;
+	typedef struct violation{
+		nsec_t at;		//virtual time
+		const char* what;
+		nsec_t got;
+		nsec_t need;
+	}Violation;
+
+	Target( uint16_t devid = TARGET_DEVID, uint32_t words = TARGET_WORDS,
+			uint16_t row = TARGET_ROW, uint16_t latches = TARGET_ROW ){
+		m_row = row;
+		m_latches = latches;
+		m_latch.assign( latches, ERASED );
+		m_flash.assign( words, ERASED );
+		for( int i = 0; i < 0x300; i++ ) m_space[i] = 0;
+		for( int i = 0; i < 4; i++ ) m_space[i] = ERASED;
+		for( int i = 7; i < 12; i++ ) m_space[i] = ERASED;
+		m_space[0x005] = TARGET_REVID;
+		m_space[0x006] = devid;
+		for( int i = 0; i < 9; i++ ) m_space[0x100 + i] = 0x1000 + i;	//MUI
+		for( int i = 0; i < 8; i++ ) m_space[0x10a + i] = 0x2000 + i;	//EUI
+		m_space[0x200] = row;	//ERSIZ
+		m_space[0x201] = latches;	//WLSIZ
+		m_space[0x202] = words / row;	//URSIZ
+		m_space[0x203] = 0;	//EESIZ
+		m_space[0x204] = TARGET_PINS;	//PCNT
+		m_need[IDLE] = 0;
+		m_need[BULK] = TERAB;
+		m_need[ROW] = TERAR;
+		m_need[PROGRAM] = TPINT;
+		m_need[EXTPROGRAM] = TPEXT;
+		m_need[ENDEXT] = TDIS;
+		for( int i = 0; i < BUSYCOUNT; i++ ) m_actual[i] = m_need[i] * TARGET_SPEED / 100;
+		m_lines = 0;
+		m_now = 0;
+		m_violations = 0;
+		m_commands = 0;
+		m_programmed = 0;
+		m_lost = 0;
+		reset();
+	}
+
+	/* Wire side */
+	void edge( uint32_t set, uint32_t clr ){
+		uint32_t was = m_lines;
+		m_lines = ( m_lines & ~clr ) | set;
+		uint32_t fell = was & ~m_lines;
+		uint32_t rose = m_lines & ~was;
+		if( fell & LINE_POWER ){
+			settle( m_now );
+			reset();
+		}
+		if( rose & LINE_MCLR ){
+			settle( m_now );
+			m_lvp = false;
+		}
+		if( fell & LINE_MCLR ) m_mclrat = m_now;
+	}
+	void hold( nsec_t ns ){
+		m_now += ns;
+	}
+	void write( uint32_t word, unsigned int numberofbits ){
+		nsec_t at = m_now;
+		m_now += numberofbits * ( TCKH + TCKL );
+		if( !( m_lines & LINE_POWER ) || ( m_lines & LINE_MCLR ) ) return;
+		if( !m_lvp ){
+			if( numberofbits != 32 || word != TARGET_KEY ){
+				violation( "bits before the entry key", 0, 0 );
+				return;
+			}
+			gap( "TENTH before key", at - m_mclrat, TENTH );
+			m_lvp = true;
+			m_last = m_now;
+			m_gap = TENTH;
+			m_gapname = "TENTH after key";
+			return;
+		}
+		if( m_expect != IDLECMD ){
+			if( numberofbits != PAYLOADSZ ){
+				violation( "command while a payload was due", numberofbits, PAYLOADSZ );
+				m_expect = IDLECMD;
+				return;
+			}
+			gap( "TDLY before payload", at - m_last, TDLY );
+			payload( ( word >> STOPBIT ) & 0xffff );
+			m_last = m_now;
+			m_gap = TDLY;
+			m_gapname = "TDLY after payload";
+			return;
+		}
+		if( numberofbits != 8 ){
+			violation( "payload without a command", numberofbits, 8 );
+			return;
+		}
+		settle( at );
+		gap( m_gapname, at - m_last, m_gap );
+		command( word & 0xff );
+	}
+	uint32_t read( unsigned int numberofbits ){
+		nsec_t at = m_now;
+		m_now += numberofbits * ( TCKH + TCKL );
+		if( !m_lvp || !m_hasout ){
+			violation( "read without READNVM", 0, 0 );
+			return 0;
+		}
+		gap( "TDLY before read", at - m_last, TDLY );
+		m_hasout = false;
+		m_last = m_now;
+		m_gap = TDLY;
+		m_gapname = "TDLY after payload";
+		return ( (uint32_t)m_out << STOPBIT ) & ( ( 1u << numberofbits ) - 1 );
+	}
+
+	/* Bench side */
+	/* The part really finishes op after ns; shorter dwells lose the op */
+	void setDwell( Busy op, nsec_t ns ){
+		m_actual[op] = ns;
+	}
+	uint16_t word( uint32_t address ) const{
+		if( address < m_flash.size() ) return m_flash[address];
+		if( address >= 0x8000 && address < 0x8300 ) return m_space[address - 0x8000];
+		return 0;
+	}
+	uint32_t words() const{ return m_flash.size(); }
+	nsec_t elapsed() const{ return m_now; }
+	unsigned violations() const{ return m_violations; }
+	unsigned commands() const{ return m_commands; }
+	unsigned lost() const{ return m_lost; }
+	const std::vector<Violation>& details() const{ return m_detail; }
+
+	void print( FILE* fp ) const{
+		fprintf(fp, "Target %04x: %u commands, %u rows/words programmed, %u ops lost, "
+				"%u timing violations, %" PRIu64 " us on the wire\n",
+				m_space[0x006], m_commands, m_programmed, m_lost, m_violations, m_now / USEC );
+		for( size_t i = 0; i < m_detail.size(); i++ ){
+			const Violation& v = m_detail[i];
+			fprintf(fp, "  @%" PRIu64 " us: %s (%" PRIu64 " < %" PRIu64 " ns)\n",
+					v.at / USEC, v.what, v.got, v.need );
+		}
+		if( m_violations > m_detail.size() ){
+			fprintf(fp, "  ... %zu more\n", m_violations - m_detail.size());
+		}
+	}
+
+private:
+	static const uint8_t IDLECMD = 0xff;
+
+	void reset(){
+		m_lvp = false;
+		m_pc = 0;
+		m_expect = IDLECMD;
+		m_hasout = false;
+		m_busy = IDLE;
+		m_last = m_now;
+		m_mclrat = m_now;
+		m_gap = 0;
+		m_gapname = "TDLY after command";
+		clearLatches();
+	}
+	void clearLatches(){
+		m_latch.assign( m_latches, ERASED );
+	}
+
+	void command( uint8_t cmd ){
+		m_commands++;
+		m_last = m_now;
+		m_gap = TDLY;
+		m_gapname = "TDLY after command";
+		switch( cmd ){
+			case Instructions::SETPC:
+			case Instructions::LOADNVM:
+			case Instructions::LOADNVM_INCPC:
+				m_expect = cmd;
+				break;
+			case Instructions::READNVM:
+			case Instructions::READNVM_INCPC:
+				m_out = word( m_pc );
+				m_hasout = true;
+				if( cmd == Instructions::READNVM_INCPC ) m_pc++;
+				break;
+			case Instructions::INCPC:
+				m_pc++;
+				break;
+			case Instructions::BULKERASE:       busy( BULK, "TERAB" ); break;
+			case Instructions::ROWERASE:        busy( ROW, "TERAR" ); break;
+			case Instructions::BEGININTPROGRAM: busy( PROGRAM, "TPINT" ); break;
+			case Instructions::BEGINEXTPROGRAM: busy( EXTPROGRAM, "TPEXT" ); break;
+			case Instructions::ENDEXTPROGRAM:   busy( ENDEXT, "TDIS" ); break;
+			default:
+				violation( "unknown command", cmd, 0 );
+		}
+	}
+	void payload( uint16_t data ){
+		switch( m_expect ){
+			case Instructions::SETPC:
+				m_pc = data;
+				break;
+			case Instructions::LOADNVM:
+			case Instructions::LOADNVM_INCPC:
+				m_latch[ m_pc % m_latches ] = data & ERASED;
+				if( m_expect == Instructions::LOADNVM_INCPC ) m_pc++;
+				break;
+		}
+		m_expect = IDLECMD;
+	}
+
+	/* A self-timed operation starts now and finishes at the next command */
+	void busy( Busy op, const char* name ){
+		m_busy = op;
+		m_busypc = m_pc;
+		m_gap = m_need[op];
+		m_gapname = name;
+	}
+	/* The operation in progress, if any, ended at t */
+	void settle( nsec_t t ){
+		if( m_busy == IDLE ) return;
+		Busy op = m_busy;
+		m_busy = IDLE;
+		if( t - m_last < m_actual[op] ){
+			m_lost++;
+			if( op == PROGRAM || op == EXTPROGRAM ) clearLatches();
+			return;
+		}
+		uint32_t pc = m_busypc;
+		switch( op ){
+			case BULK:
+				m_flash.assign( m_flash.size(), ERASED );
+				if( pc >= 0x8000 && pc < 0x8100 ){
+					for( int i = 0; i < 4; i++ ) m_space[i] = ERASED;
+					for( int i = 7; i < 12; i++ ) m_space[i] = ERASED;
+				}
+				break;
+			case ROW:
+				if( pc < m_flash.size() ){
+					uint32_t base = pc - pc % m_row;
+					for( uint32_t i = 0; i < m_row; i++ ) m_flash[base + i] = ERASED;
+				}
+				else if( pc >= 0x8000 && pc < 0x8004 ){
+					for( int i = 0; i < 4; i++ ) m_space[i] = ERASED;
+				}
+				else violation( "row erase outside flash/user ID", pc, 0 );
+				break;
+			case PROGRAM:
+			case EXTPROGRAM:
+				program( pc );
+				break;
+			default:
+				break;
+		}
+	}
+	/* Programming can only clear bits */
+	void program( uint32_t pc ){
+		if( pc < m_flash.size() ){
+			uint32_t base = pc - pc % m_latches;
+			for( uint32_t i = 0; i < m_latches; i++ ) m_flash[base + i] &= m_latch[i];
+			m_programmed++;
+		}
+		else if( ( pc >= 0x8000 && pc < 0x8004 ) || ( pc >= 0x8007 && pc < 0x800c ) ){
+			m_space[pc - 0x8000] &= m_latch[ pc % m_latches ];
+			m_programmed++;
+		}
+		else violation( "program at a read-only address", pc, 0 );
+		clearLatches();
+	}
+
+	void gap( const char* what, nsec_t got, nsec_t need ){
+		if( got < need ) violation( what, got, need );
+	}
+	void violation( const char* what, nsec_t got, nsec_t need ){
+		m_violations++;
+		if( m_detail.size() == TARGET_REPORT ) return;
+		Violation v = { m_now, what, got, need };
+		m_detail.push_back( v );
+	}
+
+	std::vector<uint16_t> m_flash;
+	uint16_t m_space[0x300];	//0x8000-0x82ff: user ID, IDs, config, DIA, DCI
+	uint32_t m_row;		//erase row
+	uint32_t m_latches;
+	std::vector<uint16_t> m_latch;
+
+	uint32_t m_lines;
+	bool m_lvp;
+	uint16_t m_pc;
+	uint8_t m_expect;	//command whose payload is due
+	bool m_hasout;
+	uint16_t m_out;
+
+	Busy m_busy;
+	uint32_t m_busypc;
+	nsec_t m_need[BUSYCOUNT];
+	nsec_t m_actual[BUSYCOUNT];
+
+	nsec_t m_now;
+	nsec_t m_last;		//end of the last command, payload or key
+	nsec_t m_gap;		//minimum gap before the next command
+	const char* m_gapname;
+	nsec_t m_mclrat;
+
+	unsigned m_violations;
+	unsigned m_commands;
+	unsigned m_programmed;
+	unsigned m_lost;
+	std::vector<Violation> m_detail;
+};
+const uint8_t Target::IDLECMD;
+
+#endif
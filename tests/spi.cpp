@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "timing.h"
+#include "instructions.h"
+#include "transport.h"
+#include "spi.h"
+
+/*
+ * SPITransport framing and batching, checked against RecordingSPIBus so
+ * no controller or GPIO is needed.
+ */
+
+static int s_failed = 0;
+#define CHECK( c ) do{ if( !(c) ){ fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #c); s_failed++; } }while( 0 )
+
+/* GPIO side of the transport; nothing in these checks reaches it */
+class Idle final : public Transport{
+public:
+	void edge( uint32_t, uint32_t ){
+	}
+	void hold( nsec_t ){
+	}
+	void write( uint32_t, unsigned int ){
+	}
+	uint32_t read( unsigned int ){
+		return 0;
+	}
+};
+
+static void command( SPITransport& spi, uint8_t cmd ){
+	spi.write( cmd, 8 );
+	spi.hold( TDLY );
+}
+static void payload( SPITransport& spi, uint8_t cmd, uint32_t data ){
+	command( spi, cmd );
+	spi.write( data << STOPBIT, PAYLOADSZ );
+	spi.hold( TDLY );
+}
+
+/* A 32 word row as Programmer::loadRow() sends it goes out as one
+ * message: every command and payload its own transfer, TDLY riding on
+ * each as delay_usecs, the TPINT dwell flushed and waited on the host */
+static void rowLoad(){
+	RecordingSPIBus bus;
+	Idle gpio;
+	SPITransport spi( bus, gpio );
+	uint32_t addr = 0x0040;
+	payload( spi, Instructions::SETPC, addr );
+	for( uint32_t i = 0; i < 32; i++ ) payload( spi, Instructions::LOADNVM_INCPC, 0x1000 + i );
+	payload( spi, Instructions::SETPC, addr );
+	CHECK( bus.log.empty() );	//still queued
+	CHECK( bus.muxed );
+	nsec_t t = Timing::now();
+	spi.write( Instructions::BEGININTPROGRAM, 8 );
+	spi.hold( TPINT );
+	t = Timing::now() - t;
+
+	CHECK( bus.messages == 1 );
+	CHECK( bus.log.size() == 2 * 34 + 1 );
+	for( size_t k = 0; k + 1 < bus.log.size(); k += 2 ){
+		const RecordingSPIBus::Record& c = bus.log[k];
+		const RecordingSPIBus::Record& p = bus.log[k + 1];
+		uint32_t want = k == 0 || k == 2 * 33 ? addr : 0x1000 + ( k / 2 - 1 );
+		uint32_t word = ( want << STOPBIT ) & 0xffffff;
+		CHECK( c.bytes.size() == 1 && p.bytes.size() == 3 );
+		CHECK( c.bytes[0] == ( k == 0 || k == 2 * 33 ? Instructions::SETPC : Instructions::LOADNVM_INCPC ) );
+		CHECK( p.bytes[0] == ( word >> 16 ) && p.bytes[1] == ( ( word >> 8 ) & 0xff ) && p.bytes[2] == ( word & 0xff ) );
+		CHECK( c.delay == TDLY / USEC && p.delay == TDLY / USEC );
+	}
+	const RecordingSPIBus::Record& last = bus.log.back();
+	CHECK( last.bytes.size() == 1 && last.bytes[0] == Instructions::BEGININTPROGRAM );
+	CHECK( last.delay == 0 );
+	CHECK( t >= TPINT );
+	spi.release();
+	CHECK( !bus.muxed );
+}
+
+/* A hold of SPI_MAXHOLD or more is not put on the bus */
+static void longHold(){
+	RecordingSPIBus bus;
+	Idle gpio;
+	SPITransport spi( bus, gpio );
+	spi.write( Instructions::BULKERASE, 8 );
+	nsec_t t = Timing::now();
+	spi.hold( SPI_MAXHOLD );
+	t = Timing::now() - t;
+	CHECK( bus.messages == 1 );
+	CHECK( bus.log.size() == 1 && bus.log[0].delay == 0 );
+	CHECK( t >= SPI_MAXHOLD );
+}
+
+/* Short holds that would take delay_usecs past SPI_MAXDELAY end the
+ * message there; the rest is waited on the host */
+static void delayOverflow(){
+	RecordingSPIBus bus;
+	Idle gpio;
+	SPITransport spi( bus, gpio );
+	nsec_t step = SPI_MAXHOLD - USEC;
+	uint32_t fit = SPI_MAXDELAY / ( step / USEC );
+	spi.write( Instructions::INCPC, 8 );
+	for( uint32_t i = 0; i < fit; i++ ) spi.hold( step );
+	CHECK( bus.messages == 0 );
+	spi.hold( step );
+	CHECK( bus.messages == 1 );
+	CHECK( bus.log.size() == 1 );
+	CHECK( bus.log[0].delay == fit * ( step / USEC ) );
+	CHECK( bus.log[0].delay <= SPI_MAXDELAY );
+	spi.write( Instructions::INCPC, 8 );
+	spi.flush();
+	CHECK( bus.messages == 2 && bus.log.size() == 2 && bus.log[1].delay == 0 );
+}
+
+int main(){
+	rowLoad();
+	longHold();
+	delayOverflow();
+	fprintf(stdout, "spi: %s\n", s_failed ? "FAIL" : "OK");
+	return s_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "image.h"
+#include "verify.h"
+#include "dwell.h"
+#include "target.h"
+#include "programmer.h"
+
+/*
+ * End to end on the emulated part: program, verify and read back an
+ * image through Programmer, with Target checking every hold against the
+ * datasheet; then the same with a bulk erase dwell cut short.
+ */
+
+static int s_failed = 0;
+#define CHECK( c ) do{ if( !(c) ){ fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #c); s_failed++; } }while( 0 )
+
+/* Three rows of a pattern, the middle one partial, and a gap */
+static Image pattern( uint32_t rowsize ){
+	Image img( rowsize );
+	uint32_t words[3 * DEVICE_MAXROW];
+	for( uint32_t i = 0; i < 3 * rowsize; i++ ) words[i] = ( 0x0123 + 0x0f1 * i ) & 0x3fff;
+	img.load( words, rowsize + rowsize / 2, 0 );
+	img.load( words + 2 * rowsize, rowsize, 5 * rowsize );
+	return img;
+}
+
+static void program( Programmer& pic, const Image& img ){
+	pic.setPC( 0x8000 );
+	pic.bulkErase();
+	pic.uploadMain( img );
+}
+
+static void roundTrip(){
+	Target target;
+	Programmer pic( target );
+	pic.start();
+	Image img = pattern( pic.device().rowsize() );
+	program( pic, img );
+
+	Verify verify( Verify::FULL );
+	CHECK( pic.verify( img, verify ) );
+	CHECK( verify.mismatches().empty() );
+
+	Image back;
+	pic.readRows( img, back );
+	for( uint32_t r = img.first(); r != Image::NOROW; r = img.next( r ) ){
+		CHECK( back.present( r ) );
+		for( uint32_t i = 0; i < img.rowsize(); i++ ){
+			uint32_t a = r * img.rowsize() + i;
+			CHECK( back.get( a ) == img.get( a ) );
+			CHECK( target.word( a ) == img.get( a ) );
+		}
+	}
+	pic.stop();
+	CHECK( target.violations() == 0 );
+	if( target.violations() ) target.print( stderr );
+}
+
+static void shortErase(){
+	Target target;
+	Programmer pic( target );
+	pic.start();
+	Dwell d = pic.dwell();
+	d.erab = TERAB / 2;
+	pic.setDwell( d );
+	program( pic, pattern( pic.device().rowsize() ) );
+	pic.stop();
+	CHECK( target.violations() > 0 );
+}
+
+int main(){
+	setenv( "HOME", "/nonexistent", 1 );	//spec dwells, not a saved profile
+	Log::start( Log::INFO, stdout );
+	roundTrip();
+	shortErase();
+	Log::stop();
+	fprintf(stdout, "target: %s\n", s_failed ? "FAIL" : "OK");
+	return s_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <time.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#ifndef __TIMING_HEADER__
+#define __TIMING_HEADER__
+
+typedef uint64_t nsec_t;
+
+const nsec_t NSEC = 1;
+const nsec_t USEC = 1000 * NSEC;
+const nsec_t MSEC = 1000 * USEC;
+
+/* PIC16F152xx Family Programming Spec, Table 8-1 (AC/DC characteristics)
+ * Clock/data holds are the spec minimums, dwells are the spec maximums. */
+const nsec_t TENTS =  100 * NSEC;	//MCLR low to first clock (entry setup)
+const nsec_t TENTH =  250 * USEC;	//entry hold
+const nsec_t TCKL  =  100 * NSEC;	//clock low
+const nsec_t TCKH  =  100 * NSEC;	//clock high
+const nsec_t TDS   =  100 * NSEC;	//data setup before clock falling edge
+const nsec_t TDH   =  100 * NSEC;	//data hold after clock falling edge
+const nsec_t TDLY  =    1 * USEC;	//between command and payload
+const nsec_t TERAB =   13 * MSEC;	//bulk erase
+const nsec_t TERAR = 2800 * USEC;	//row erase
+const nsec_t TPEXT = 2100 * USEC;	//externally timed programming
+const nsec_t TPINT = 2800 * USEC;	//internally timed programming
+const nsec_t TEXIT =    1 * USEC;	//programming mode exit
+const nsec_t TDIS  =  300 * USEC;	//end of externally timed programming
+
+/*
+ * Delay engine used for every ICSP hold and dwell.
+ *
+ * usleep() on a stock kernel overshoots by 50-100us, which is ten times the
+ * clock period we need. Short holds therefore busy-wait on CLOCK_MONOTONIC
+ * (vDSO, no syscall). Long dwells sleep for most of the interval and spin
+ * only for the last stretch, so TERAB/TPINT don't burn a core and don't
+ * overshoot either. calibrate() measures the clock read cost and the
+ * scheduler wake-up slack on this machine.
+ */
+class Timing{
+public:
+	static void calibrate(){
+		if( s_calibrated ) return;
+		s_calibrated = true;
+
+		/* Cheapest observed clock read */
+		nsec_t best = ~(nsec_t)0;
+		for( int i = 0; i < 1000; i++ ){
+			nsec_t a = now();
+			nsec_t b = now();
+			if( b - a < best ) best = b - a;
+		}
+		s_overhead = best;
+
+		/* Worst observed oversleep of a short nanosleep */
+		nsec_t worst = 0;
+		for( int i = 0; i < 20; i++ ){
+			nsec_t a = now();
+			sleep( 100 * USEC );
+			nsec_t late = now() - a - 100 * USEC;
+			if( late > worst && late < 10 * MSEC ) worst = late;
+		}
+		s_slack = worst + 20 * USEC;
+	}
+
+	static inline nsec_t now(){
+		struct timespec ts;
+		clock_gettime( CLOCK_MONOTONIC, &ts );
+		return (nsec_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	}
+
+	/* Wait ns from now */
+	static inline void wait( nsec_t ns ){
+		if( ns <= s_overhead ) return;
+		nsec_t start = now();
+		nsec_t end = until( start + ns - s_overhead );
+		if( s_track ) record( end - start, ns );
+	}
+
+	/* Wait until an absolute CLOCK_MONOTONIC deadline, returns the time
+	 * it actually got there */
+	static inline nsec_t until( nsec_t deadline ){
+		nsec_t t = now();
+		if( deadline <= t ) return t;
+		if( deadline - t > 2 * s_slack ){
+			sleep( deadline - t - s_slack );
+		}
+		while( (t = now()) < deadline );
+		return t;
+	}
+
+	/* Jitter tracking: how far past its requested width any hold ran */
+	static void track( bool on ){
+		s_track = on;
+		s_holds = 0;
+		s_stretched = 0;
+		s_worst = 0;
+		s_worstof = 0;
+	}
+	static nsec_t worst(){ return s_worst; }
+	static void printJitter( FILE* fp ){
+		fprintf(fp, "Holds: %" PRIu64 ", worst overrun %" PRIu64 " ns on a %" PRIu64
+				" ns hold, %" PRIu64 " stretched past 2x\n",
+				s_holds, s_worst, s_worstof, s_stretched );
+	}
+
+	static nsec_t overhead(){ return s_overhead; }
+	static nsec_t slack(){ return s_slack; }
+
+	static void print( FILE* fp ){
+		fprintf(fp, "Timer overhead: %" PRIu64 " ns, sleep slack: %" PRIu64 " ns\n",
+				s_overhead, s_slack );
+	}
+
+private:
+	static inline void record( nsec_t took, nsec_t ns ){
+		s_holds++;
+		if( took <= ns ) return;
+		if( took - ns > s_worst ){
+			s_worst = took - ns;
+			s_worstof = ns;
+		}
+		if( took > 2 * ns ) s_stretched++;
+	}
+	static void sleep( nsec_t ns ){
+		struct timespec ts;
+		ts.tv_sec  = ns / 1000000000ULL;
+		ts.tv_nsec = ns % 1000000000ULL;
+		while( clock_nanosleep( CLOCK_MONOTONIC, 0, &ts, &ts ) == EINTR );
+	}
+
+	static bool   s_calibrated;
+	static nsec_t s_overhead;
+	static nsec_t s_slack;
+	static bool   s_track;
+	static nsec_t s_holds;
+	static nsec_t s_stretched;
+	static nsec_t s_worst;
+	static nsec_t s_worstof;
+};
+bool   Timing::s_calibrated = false;
+nsec_t Timing::s_overhead   = 0;
+nsec_t Timing::s_slack      = 200 * USEC;
+bool   Timing::s_track      = false;
+nsec_t Timing::s_holds      = 0;
+nsec_t Timing::s_stretched  = 0;
+nsec_t Timing::s_worst      = 0;
+nsec_t Timing::s_worstof    = 0;
+
+#endif
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <atomic>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "timing.h"
+#include "instructions.h"
+
+#ifndef __TRACE_HEADER__
+#define __TRACE_HEADER__
+
+#define TRACE_SIZE 16384	//events kept, power of two
+
+/*
+ * Flight recorder for ICSP commands.
+ *
+ * Programmer calls command() before shifting an opcode, payload() after
+ * a payload goes out or comes back, and wired() after a bare opcode. Each
+ * event holds the opcode, payload, the PC it applied to and three stamps:
+ * start, end of wire traffic, and end (the next command's start), so
+ * wire time and dwell time are separate. Stamps are raw counter ticks
+ * (CNTVCT_EL0 / TSC), a few ns to take, converted to ns only on export.
+ *
+ * The ring is single producer and overwrites the oldest events. head is
+ * published with release order, so a reader (chrome(), possibly from an
+ * exit handler) sees every completed slot without taking a lock.
+ */
+class Trace{
+public:
+	typedef struct event{
+		uint64_t start;
+		uint64_t wire;
+		uint64_t end;
+		uint32_t payload;
+		uint16_t pc;
+		uint8_t  opcode;
+		uint8_t  haspayload;
+	}Event;
+
+	Trace(){
+		m_head.store( 0, std::memory_order_relaxed );
+		m_pc = 0;
+		m_tick0 = ticks();
+		m_ns0 = Timing::now();
+	}
+
+	static inline uint64_t ticks(){
+#if defined(__aarch64__)
+		uint64_t t;
+		asm volatile( "isb; mrs %0, cntvct_el0" : "=r"(t) );
+		return t;
+#elif defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#else
+		return Timing::now();
+#endif
+	}
+
+	inline void command( uint8_t opcode ){
+		uint64_t t = ticks();
+		uint64_t h = m_head.load( std::memory_order_relaxed );
+		if( h && !m_ring[ (h - 1) & (TRACE_SIZE - 1) ].end ) m_ring[ (h - 1) & (TRACE_SIZE - 1) ].end = t;
+		Event& e = m_ring[ h & (TRACE_SIZE - 1) ];
+		e.start = t;
+		e.wire = t;
+		e.end = 0;
+		e.payload = 0;
+		e.pc = m_pc;
+		e.opcode = opcode;
+		e.haspayload = 0;
+		if( opcode == Instructions::INCPC || opcode == Instructions::LOADNVM_INCPC ||
+				opcode == Instructions::READNVM_INCPC ) m_pc++;
+		m_head.store( h + 1, std::memory_order_release );
+	}
+	inline void wired(){
+		uint64_t h = m_head.load( std::memory_order_relaxed );
+		if( h ) m_ring[ (h - 1) & (TRACE_SIZE - 1) ].wire = ticks();
+	}
+	inline void payload( uint32_t data ){
+		uint64_t h = m_head.load( std::memory_order_relaxed );
+		if( !h ) return;
+		Event& e = m_ring[ (h - 1) & (TRACE_SIZE - 1) ];
+		e.wire = ticks();
+		e.payload = data;
+		e.haspayload = 1;
+		if( e.opcode == Instructions::SETPC ) m_pc = data;
+	}
+	/* End the last event, e.g. when the session stops or before traffic
+	 * that isn't a command, such as the entry key. An event ends once */
+	void close(){
+		uint64_t h = m_head.load( std::memory_order_relaxed );
+		if( h && !m_ring[ (h - 1) & (TRACE_SIZE - 1) ].end ) m_ring[ (h - 1) & (TRACE_SIZE - 1) ].end = ticks();
+	}
+	uint64_t size() const{
+		uint64_t h = m_head.load( std::memory_order_acquire );
+		return h < TRACE_SIZE ? h : TRACE_SIZE;
+	}
+
+	/* Chrome trace event JSON, also opened by ui.perfetto.dev. Each command
+	 * is a span with its wire traffic nested inside */
+	bool chrome( const char* path ){
+		FILE* fp = fopen( path, "w" );
+		if( fp == NULL ){
+			fprintf(stderr, "Cannot write %s\n", path);
+			return false;
+		}
+		uint64_t h = m_head.load( std::memory_order_acquire );
+		uint64_t first = h > TRACE_SIZE ? h - TRACE_SIZE : 0;
+		uint64_t now = ticks();
+		double scale = (double)( Timing::now() - m_ns0 ) / (double)( now - m_tick0 );
+		fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+		for( uint64_t i = first; i < h; i++ ){
+			const Event& e = m_ring[ i & (TRACE_SIZE - 1) ];
+			uint64_t end = e.end ? e.end : ( e.wire > e.start ? e.wire : now );
+			double ts = ( e.start - m_tick0 ) * scale / 1000.0;
+			double dur = ( end - e.start ) * scale / 1000.0;
+			double wire = ( e.wire - e.start ) * scale / 1000.0;
+			fprintf(fp, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f,"
+					"\"args\":{\"pc\":\"0x%04x\"",
+					i == first ? "" : ",\n", name( e.opcode ), ts, dur, e.pc);
+			if( e.haspayload ) fprintf(fp, ",\"payload\":\"0x%04x\"", e.payload);
+			fprintf(fp, "}}");
+			fprintf(fp, ",\n{\"name\":\"wire\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}",
+					ts, wire);
+		}
+		fprintf(fp, "\n]}\n");
+		fclose( fp );
+		fprintf(stdout, "Trace: %" PRIu64 " of %" PRIu64 " commands written to %s\n", h - first, h, path);
+		return true;
+	}
+
+	static const char* name( uint8_t opcode ){
+		switch( opcode ){
+			case Instructions::READNVM:         return "READNVM";
+			case Instructions::READNVM_INCPC:   return "READNVM_INCPC";
+			case Instructions::SETPC:           return "SETPC";
+			case Instructions::INCPC:           return "INCPC";
+			case Instructions::LOADNVM:         return "LOADNVM";
+			case Instructions::LOADNVM_INCPC:   return "LOADNVM_INCPC";
+			case Instructions::BULKERASE:       return "BULKERASE";
+			case Instructions::ROWERASE:        return "ROWERASE";
+			case Instructions::BEGININTPROGRAM: return "BEGININTPROGRAM";
+			case Instructions::BEGINEXTPROGRAM: return "BEGINEXTPROGRAM";
+			case Instructions::ENDEXTPROGRAM:   return "ENDEXTPROGRAM";
+		}
+		return "unknown";
+	}
+
+private:
+	Event m_ring[TRACE_SIZE];
+	std::atomic<uint64_t> m_head;
+	uint16_t m_pc;
+	uint64_t m_tick0;
+	nsec_t m_ns0;
+};
+
+#endif
@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "pic.h"
+#include "timing.h"
+
+#ifndef __TRANSPORT_HEADER__
+#define __TRANSPORT_HEADER__
+
+/* Programming lines, named by their bit in GPIO_SET/GPIO_CLR on the
+ * default wiring. Every transport speaks in these masks. */
+const uint32_t LINE_MCLR  = 1u << GPIO_MCLR;
+const uint32_t LINE_CLOCK = 1u << GPIO_CLOCK;
+const uint32_t LINE_DATA  = 1u << GPIO_DATA;
+const uint32_t LINE_POWER = 1u << GPIO_POWER;
+const uint32_t LINE_ALL   = LINE_MCLR | LINE_CLOCK | LINE_DATA | LINE_POWER;
+
+/*
+ * The wire under Programmer.
+ *
+ * edge() moves lines (pins in both masks end up low), hold() keeps them
+ * steady, write() shifts a command or payload out MSB first and read()
+ * clocks raw bits in MSB first; start/stop bit framing is left to the
+ * caller. Implementations: BitBang (GPIO), SPITransport (spidev with
+ * GPIO for the rest), Recorder (into a Session) and Target (emulated
+ * PIC16F152xx).
+ */
+class Transport{
+public:
+	virtual ~Transport(){
+	}
+	virtual void edge( uint32_t set, uint32_t clr ) = 0;
+	virtual void hold( nsec_t ns ) = 0;
+	virtual void write( uint32_t word, unsigned int numberofbits ) = 0;
+	virtual uint32_t read( unsigned int numberofbits ) = 0;
+	/* Make every line a driven output again */
+	virtual void outputs(){
+	}
+	/* Forget cached line directions after someone else touched GPFSEL */
+	virtual void invalidate(){
+	}
+};
+
+/* Clock word out on t's own edge()/hold(). Data is latched on the falling
+ * clock edge, so data and the rising clock edge go out in the same store
+ * whenever the data bit is high. T is final, so the calls are inlined. */
+template<class T>
+inline void shiftOut( T& t, uint32_t word, unsigned int numberofbits ){
+	bool high = true; //unknown, force the first clear
+	for( int i = numberofbits - 1; i >= 0; i-- ){
+		if( (word >> i) & 0x0001 ){
+			t.edge( LINE_CLOCK | LINE_DATA, 0 );
+			high = true;
+		}
+		else{
+			if( high ) t.edge( 0, LINE_DATA );
+			t.edge( LINE_CLOCK, 0 );
+			high = false;
+		}
+		t.hold( TCKH );
+
+		t.edge( 0, LINE_CLOCK );
+		t.hold( TCKL );
+	}
+}
+
+#endif
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <vector>
+
+#ifndef __VERIFY_HEADER__
+#define __VERIFY_HEADER__
+
+/*
+ * Result of a deferred verify pass.
+ *
+ * Programmer::verify() feeds every word read back through word() as it
+ * comes off the wire. FULL compares word by word and coalesces mismatches
+ * into address ranges, CHECKSUM only folds both streams into a CRC-16
+ * (CCITT) and compares the two at the end, SKIP does nothing. Nothing is
+ * printed until report().
+ */
+class Verify{
+public:
+	typedef enum{
+		FULL, CHECKSUM, SKIP
+	}Mode;
+	typedef struct range{
+		uint32_t start;
+		uint32_t end;
+	}Range;
+
+	Verify( Mode m = FULL ){
+		m_mode = m;
+		begin();
+	}
+	static bool parse( const char* s, Mode& m ){
+		if( strcmp( s, "full" ) == 0 ) m = FULL;
+		else if( strcmp( s, "crc" ) == 0 ) m = CHECKSUM;
+		else if( strcmp( s, "none" ) == 0 ) m = SKIP;
+		else return false;
+		return true;
+	}
+
+	Mode mode(){ return m_mode; }
+	void begin(){
+		m_ranges.clear();
+		m_crc = 0xffff;
+		m_expect = 0xffff;
+		m_words = 0;
+	}
+	inline void word( uint32_t address, uint32_t got, uint32_t want ){
+		if( m_mode == FULL ){
+			if( got != want ) mismatch( address );
+		}
+		else{
+			m_crc = crc( m_crc, got );
+			m_expect = crc( m_expect, want );
+		}
+		m_words++;
+	}
+
+	bool passed(){
+		if( m_mode == FULL ) return m_ranges.empty();
+		if( m_mode == CHECKSUM ) return m_crc == m_expect;
+		return true;
+	}
+	const std::vector<Range>& mismatches(){ return m_ranges; }
+
+	void report( FILE* fp ){
+		if( m_mode == SKIP ){
+			fprintf(fp, "Verify skipped\n");
+			return;
+		}
+		if( m_mode == CHECKSUM ){
+			fprintf(fp, "Verify: %u words, crc %04x expected %04x: %s\n",
+					m_words, m_crc, m_expect, passed() ? "OK" : "FAILED" );
+			return;
+		}
+		fprintf(fp, "Verify: %u words, %zu mismatching ranges: %s\n",
+				m_words, m_ranges.size(), passed() ? "OK" : "FAILED" );
+		for( size_t i = 0; i < m_ranges.size(); i++ ){
+			fprintf(fp, "  %04x-%04x\n", m_ranges[i].start, m_ranges[i].end);
+		}
+	}
+
+private:
+	void mismatch( uint32_t address ){
+		if( !m_ranges.empty() && m_ranges.back().end + 1 == address ){
+			m_ranges.back().end = address;
+			return;
+		}
+		Range r = { address, address };
+		m_ranges.push_back( r );
+	}
+	static inline uint16_t crc( uint16_t c, uint32_t w ){
+		c ^= (uint16_t)w;
+		for( int i = 0; i < 16; i++ ){
+			c = ( c & 0x8000 ) ? ( c << 1 ) ^ 0x1021 : ( c << 1 );
+		}
+		return c;
+	}
+
+	Mode m_mode;
+	std::vector<Range> m_ranges;
+	uint16_t m_crc;
+	uint16_t m_expect;
+	uint32_t m_words;
+};
+
+#endif